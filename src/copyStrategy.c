@@ -0,0 +1,193 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "copyStrategy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+copy_strategy_t copy_strategy_mode = STRATEGY_AUTO;
+
+static const char* strategy_names[] = { "buffered", "buffered-64k", "buffered-1m", "mmap", "kernel", "direct", "auto" };
+static const char* class_names[STRATEGY_CLASSES] = { "<64K", "64K-1M", "1M-16M", "16M-256M", ">=256M" };
+
+#define BIT(s) (1u << (s))
+
+// Fixed buffers only compete where they differ from the default sizing, direct I/O only where alignment
+// overhead is amortised.
+static const unsigned class_strategies[STRATEGY_CLASSES] = {
+    BIT(STRATEGY_BUFFERED) | BIT(STRATEGY_MMAP) | BIT(STRATEGY_KERNEL),
+    BIT(STRATEGY_BUFFERED) | BIT(STRATEGY_BUFFERED_64K) | BIT(STRATEGY_MMAP) | BIT(STRATEGY_KERNEL),
+    BIT(STRATEGY_BUFFERED) | BIT(STRATEGY_BUFFERED_64K) | BIT(STRATEGY_BUFFERED_1M) | BIT(STRATEGY_MMAP) | BIT(STRATEGY_KERNEL) | BIT(STRATEGY_DIRECT),
+    BIT(STRATEGY_BUFFERED) | BIT(STRATEGY_BUFFERED_64K) | BIT(STRATEGY_BUFFERED_1M) | BIT(STRATEGY_MMAP) | BIT(STRATEGY_KERNEL) | BIT(STRATEGY_DIRECT),
+    BIT(STRATEGY_BUFFERED) | BIT(STRATEGY_BUFFERED_64K) | BIT(STRATEGY_BUFFERED_1M) | BIT(STRATEGY_MMAP) | BIT(STRATEGY_KERNEL) | BIT(STRATEGY_DIRECT)
+};
+
+#if defined(_WIN32)
+static const unsigned platform_strategies = BIT(STRATEGY_BUFFERED) | BIT(STRATEGY_BUFFERED_64K) | BIT(STRATEGY_BUFFERED_1M);
+#elif defined(__linux__)
+static const unsigned platform_strategies = BIT(STRATEGY_COUNT) - 1;
+#elif defined(O_DIRECT)
+static const unsigned platform_strategies = (BIT(STRATEGY_COUNT) - 1) & ~BIT(STRATEGY_KERNEL);
+#else
+static const unsigned platform_strategies = (BIT(STRATEGY_COUNT) - 1) & ~(BIT(STRATEGY_KERNEL) | BIT(STRATEGY_DIRECT));
+#endif
+
+typedef struct strategy_stats_t {
+    size_t picks;
+    size_t fallbacks;
+    size_t samples;
+    size_t bytes;
+    double seconds;
+    double rate;
+} strategy_stats_t;
+
+typedef struct strategy_class_t {
+    strategy_stats_t stats[STRATEGY_COUNT];
+    size_t files;
+    int recheck;
+} strategy_class_t;
+
+static pthread_mutex_t selector_mutex = PTHREAD_MUTEX_INITIALIZER;
+static strategy_class_t classes[STRATEGY_CLASSES];
+
+int parse_copy_strategy(const char* s, copy_strategy_t* out) {
+    for (int i = 0; i <= STRATEGY_AUTO; ++i) {
+        if (strcmp(s, strategy_names[i]) == 0) {
+            *out = (copy_strategy_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* copy_strategy_name(copy_strategy_t strategy) {
+    return strategy_names[strategy];
+}
+
+static int size_class(size_t file_size) {
+    if (file_size < 64 * KILO_BYTE) return 0;
+    if (file_size < MEGA_BYTE) return 1;
+    if (file_size < 16 * MEGA_BYTE) return 2;
+    if (file_size < 256 * MEGA_BYTE) return 3;
+    return 4;
+}
+
+// copy_file_range() has a single destination, a fan-out copy reads the source once for all of them.
+static int usable(int c, copy_strategy_t strategy, int dest_count) {
+    if (strategy == STRATEGY_KERNEL && dest_count > 1) return FALSE;
+    return (class_strategies[c] & platform_strategies & BIT(strategy)) != 0;
+}
+
+// A strategy that keeps handing its files to the buffered loop is not worth exploring in this class.
+static int given_up(const strategy_stats_t* stats) {
+    return stats->fallbacks >= STRATEGY_EXPLORE_SAMPLES && stats->fallbacks > stats->samples;
+}
+
+static copy_strategy_t best_strategy(const strategy_class_t* cls) {
+    copy_strategy_t best = STRATEGY_COUNT;
+    for (int s = 0; s < STRATEGY_COUNT; ++s) {
+        if (cls->stats[s].samples == 0) continue;
+        if (best == STRATEGY_COUNT || cls->stats[s].rate > cls->stats[best].rate) best = (copy_strategy_t)s;
+    }
+    return best;
+}
+
+copy_strategy_t strategy_pick(size_t file_size, int dest_count) {
+    int c = size_class(file_size);
+
+    if (copy_strategy_mode != STRATEGY_AUTO) {
+        return (platform_strategies & BIT(copy_strategy_mode)) && !(copy_strategy_mode == STRATEGY_KERNEL && dest_count > 1) ? copy_strategy_mode : STRATEGY_BUFFERED;
+    }
+
+    pthread_mutex_lock(&selector_mutex);
+    strategy_class_t* cls = &classes[c];
+    ++cls->files;
+
+    copy_strategy_t least = STRATEGY_COUNT;
+    for (int s = 0; s < STRATEGY_COUNT; ++s) {
+        if (!usable(c, (copy_strategy_t)s, dest_count) || given_up(&cls->stats[s])) continue;
+        if (least == STRATEGY_COUNT || cls->stats[s].picks < cls->stats[least].picks) least = (copy_strategy_t)s;
+    }
+
+    copy_strategy_t best = best_strategy(cls);
+    copy_strategy_t chosen = best;
+
+    if (best == STRATEGY_COUNT || !usable(c, best, dest_count) || cls->stats[least].picks < STRATEGY_EXPLORE_SAMPLES) {
+        chosen = least;
+    } else if (cls->files % STRATEGY_RECHECK_INTERVAL == 0) {
+        // Re-measure the runners-up in turn; a strategy that got faster takes over through its rate.
+        for (int step = 1; step <= STRATEGY_COUNT; ++step) {
+            int s = (cls->recheck + step) % STRATEGY_COUNT;
+            if (s == (int)best || !usable(c, (copy_strategy_t)s, dest_count) || given_up(&cls->stats[s])) continue;
+
+            cls->recheck = s;
+            chosen = (copy_strategy_t)s;
+            break;
+        }
+    }
+
+    ++cls->stats[chosen].picks;
+    pthread_mutex_unlock(&selector_mutex);
+
+    return chosen;
+}
+
+void strategy_record(size_t file_size, copy_strategy_t strategy, size_t bytes, double seconds) {
+    if (seconds <= 0) seconds = 1e-9;
+    double rate = (double)bytes / seconds;
+
+    pthread_mutex_lock(&selector_mutex);
+    strategy_stats_t* stats = &classes[size_class(file_size)].stats[strategy];
+
+    stats->rate = stats->samples == 0 ? rate : stats->rate + STRATEGY_RATE_WEIGHT * (rate - stats->rate);
+    ++stats->samples;
+    stats->bytes += bytes;
+    stats->seconds += seconds;
+    pthread_mutex_unlock(&selector_mutex);
+}
+
+void strategy_fallback(size_t file_size, copy_strategy_t strategy) {
+    if (copy_strategy_mode != STRATEGY_AUTO) return;
+
+    pthread_mutex_lock(&selector_mutex);
+    strategy_stats_t* stats = &classes[size_class(file_size)].stats[strategy];
+
+    --stats->picks;
+    ++stats->fallbacks;
+    pthread_mutex_unlock(&selector_mutex);
+}
+
+size_t strategy_buffer_size(copy_strategy_t strategy, size_t default_size) {
+    if (strategy == STRATEGY_BUFFERED_64K) return MIN(default_size, 64 * KILO_BYTE);
+    if (strategy == STRATEGY_BUFFERED_1M) return MIN(default_size, MEGA_BYTE);
+    return default_size;
+}
+
+void strategy_report(void) {
+    pthread_mutex_lock(&selector_mutex);
+
+    for (int c = 0; c < STRATEGY_CLASSES; ++c) {
+        const strategy_class_t* cls = &classes[c];
+        copy_strategy_t best = best_strategy(cls);
+        if (best == STRATEGY_COUNT) continue;
+
+        printf(CYN "Copy strategy for %-8s files: %-12s " WEAK "[", class_names[c], strategy_names[best]);
+        const char* separator = "";
+        for (int s = 0; s < STRATEGY_COUNT; ++s) {
+            const strategy_stats_t* stats = &cls->stats[s];
+            if (stats->samples == 0) continue;
+
+            printf("%s%s %.1f MB/s x%zu", separator, strategy_names[s], stats->rate / MEGA_BYTE, stats->samples);
+            separator = ", ";
+        }
+        printf("]\n" RESET);
+    }
+
+    pthread_mutex_unlock(&selector_mutex);
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef COPY_STRATEGY_H
+#define COPY_STRATEGY_H
+
+#include "core.h"
+
+#define STRATEGY_CLASSES 5
+#define STRATEGY_EXPLORE_SAMPLES 4
+#define STRATEGY_RECHECK_INTERVAL 64
+#define STRATEGY_RATE_WEIGHT 0.25
+
+#define STRATEGY_DIRECT_ALIGN 4096
+#define STRATEGY_DIRECT_BUFFER ((size_t)1 * MEGA_BYTE)
+
+// Returned by a strategy that cannot handle the file here; the buffered loop takes over where it stopped.
+#define STRATEGY_FALLBACK (-1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum copy_strategy_t {
+    STRATEGY_BUFFERED = 0,
+    STRATEGY_BUFFERED_64K,
+    STRATEGY_BUFFERED_1M,
+    STRATEGY_MMAP,
+    STRATEGY_KERNEL,
+    STRATEGY_DIRECT,
+    STRATEGY_COUNT,
+    STRATEGY_AUTO = STRATEGY_COUNT
+} copy_strategy_t;
+
+// Set once before the workers start. STRATEGY_AUTO picks per size class from measured throughput:
+// every strategy the class allows is tried STRATEGY_EXPLORE_SAMPLES times, then the fastest is used and
+// one file in STRATEGY_RECHECK_INTERVAL goes to another strategy so a changing workload is noticed.
+extern copy_strategy_t copy_strategy_mode;
+
+int parse_copy_strategy(const char* s, copy_strategy_t* out);
+const char* copy_strategy_name(copy_strategy_t strategy);
+
+copy_strategy_t strategy_pick(size_t file_size, int dest_count);
+void strategy_record(size_t file_size, copy_strategy_t strategy, size_t bytes, double seconds);
+// Takes back the pick of a strategy that handed its file to the buffered loop. After STRATEGY_EXPLORE_SAMPLES
+// such files, and more of them than measured ones, the strategy is no longer tried in that size class.
+void strategy_fallback(size_t file_size, copy_strategy_t strategy);
+
+// Buffer for the buffered variants: the fixed size, never more than calculate_buffer_size() gave the file.
+size_t strategy_buffer_size(copy_strategy_t strategy, size_t default_size);
+
+void strategy_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -1,4 +1,18 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "taskQueue.h"
+#include "inodeMap.h"
+#include "dirCache.h"
+#include "devicePools.h"
+#include "trace.h"
+#include "syncer.h"
+#include "watch.h"
+#include "pack.h"
+#include "copyStrategy.h"
+#include "throttle.h"
+#include "move.h"
 
 #ifdef _WIN32
 #include <stdlib.h>
@@ -132,6 +146,8 @@ int unlock_file(file_lock_t *lock) {
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/mman.h>
 
 struct file_lock_t {
     int fd;
@@ -165,6 +181,188 @@ int unlock_file(file_lock_t* lock) {
     return 0;
 }
 
+static int write_fully(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (written == 0) return EIO;
+
+        buf += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+int make_parents(const char* path) {
+    char buffer[MAX_PATH];
+    if (snprintf(buffer, sizeof(buffer), "%s", path) >= (int)sizeof(buffer)) return ENAMETOOLONG;
+
+    char* slash = strrchr(buffer, '/');
+    if (!slash || slash == buffer) return 0;
+    *slash = '\0';
+
+    struct stat st;
+    if (stat(buffer, &st) == 0) return S_ISDIR(st.st_mode) ? 0 : ENOTDIR;
+
+    for (char* cursor = buffer + 1; *cursor; ++cursor) {
+        if (*cursor != '/') continue;
+
+        *cursor = '\0';
+        if (mkdir(buffer, 0755) != 0 && errno != EEXIST) return errno;
+        *cursor = '/';
+    }
+    return mkdir(buffer, 0755) != 0 && errno != EEXIST ? errno : 0;
+}
+
+// Writes one chunk to every destination that is still healthy; a failed one is dropped from the copy.
+static void write_to_dests(const int* dest_fds, int dest_count, int* dest_errors, int* healthy, const char* data, size_t len, const char* const* dests) {
+    double write_start = 0;
+    if (throttle_enabled) {
+        throttle_write(len * (size_t)*healthy);
+        write_start = monotonic_seconds();
+    }
+
+    for (int k = 0; k < dest_count; ++k) {
+        if (dest_fds[k] == -1 || dest_errors[k] != 0) continue;
+
+        int write_err = write_fully(dest_fds[k], data, len);
+        if (write_err != 0) {
+            fprintf(stderr, RED "copy_file error: Write failed for \"%s\"\n" RESET, dests[k]);
+            dest_errors[k] = write_err;
+            --*healthy;
+        }
+    }
+
+    if (throttle_enabled) throttle_write_done(len * (size_t)*healthy, monotonic_seconds() - write_start);
+}
+
+// Each chunk is read once and written to every destination. Returns 0 or the source-side errno.
+static int copy_buffered(int src_fd, const int* dest_fds, int dest_count, int* dest_errors, int* healthy, size_t buff_size, size_t* copied, const char* const* dests) {
+    char* buffer = malloc(buff_size);
+    if (!buffer) {
+        fprintf(stderr, RED "copy_file error: Cannot allocate buffer memory\n" RESET);
+        return ENOMEM;
+    }
+
+    ssize_t bytes_read = 0;
+    while ((bytes_read = read(src_fd, buffer, buff_size)) > 0) {
+        if (throttle_enabled) throttle_read((size_t)bytes_read);
+        write_to_dests(dest_fds, dest_count, dest_errors, healthy, buffer, (size_t)bytes_read, dests);
+        if (*healthy == 0) break;
+
+        *copied += (size_t)bytes_read;
+    }
+
+    int err = bytes_read < 0 ? errno : 0;
+    free(buffer);
+    return err;
+}
+
+// Writes straight out of the page cache, skipping the copy into a user buffer. Copies the size seen by
+// fstat(); the source is read-locked, but a file truncated underneath anyway faults like any mmap reader.
+static int copy_mmap(int src_fd, size_t size, const int* dest_fds, int dest_count, int* dest_errors, int* healthy, size_t* copied, const char* const* dests) {
+    if (size == 0) return STRATEGY_FALLBACK;
+
+    char* data = mmap(NULL, size, PROT_READ, MAP_SHARED, src_fd, 0);
+    if (data == MAP_FAILED) return STRATEGY_FALLBACK;
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    for (size_t offset = 0; offset < size && *healthy > 0; ) {
+        size_t chunk = MIN(size - offset, throttle_chunk(MAX_BUFFER));
+        if (throttle_enabled) throttle_read(chunk);
+        write_to_dests(dest_fds, dest_count, dest_errors, healthy, data + offset, chunk, dests);
+        if (*healthy == 0) break;
+
+        offset += chunk;
+        *copied += chunk;
+    }
+
+    munmap(data, size);
+    return 0;
+}
+
+// In-kernel copy; filesystems that support it may even clone or offload it. Single destination only.
+static int copy_kernel(int src_fd, int dest_fd, size_t size, int* dest_error, int* healthy, size_t* copied) {
+#ifdef __linux__
+    size_t chunk = throttle_chunk((size_t)1 << 30);
+    for (;;) {
+        double copy_start = throttle_enabled ? monotonic_seconds() : 0;
+        ssize_t n = copy_file_range(src_fd, NULL, dest_fd, NULL, chunk, 0);
+        if (n > 0) {
+            // The kernel does both sides at once, so the buckets are charged after the fact.
+            if (throttle_enabled) {
+                throttle_write_done((size_t)n, monotonic_seconds() - copy_start);
+                throttle_read((size_t)n);
+                throttle_write((size_t)n);
+            }
+            *copied += (size_t)n;
+            continue;
+        }
+        // Pseudo-files (procfs, sysfs) report a size but look empty to copy_file_range().
+        if (n == 0) return *copied == 0 && size > 0 ? STRATEGY_FALLBACK : 0;
+        if (errno == EINTR) continue;
+        if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) return STRATEGY_FALLBACK;
+
+        // The two sides cannot be told apart here; the destination gets the blame as a write error would.
+        *dest_error = errno;
+        *healthy = 0;
+        return 0;
+    }
+#else
+    (void)src_fd; (void)dest_fd; (void)size; (void)dest_error; (void)healthy; (void)copied;
+    return STRATEGY_FALLBACK;
+#endif
+}
+
+// Reads around the page cache, which keeps a bulk copy from evicting everything else.
+static int copy_direct(const char* src, const int* dest_fds, int dest_count, int* dest_errors, int* healthy, size_t* copied, const char* const* dests) {
+#ifdef O_DIRECT
+    // A second open of the source, so it is charged to --open-limit like the first one.
+    if (throttle_enabled) throttle_open();
+    int fd = open(src, O_RDONLY | O_DIRECT);
+    if (fd == -1) return STRATEGY_FALLBACK;
+
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, STRATEGY_DIRECT_ALIGN, STRATEGY_DIRECT_BUFFER) != 0) {
+        close(fd);
+        return STRATEGY_FALLBACK;
+    }
+
+    int err = 0;
+    ssize_t bytes_read = 0;
+    while ((bytes_read = read(fd, buffer, STRATEGY_DIRECT_BUFFER)) > 0) {
+        if (throttle_enabled) throttle_read((size_t)bytes_read);
+        write_to_dests(dest_fds, dest_count, dest_errors, healthy, buffer, (size_t)bytes_read, dests);
+        if (*healthy == 0) break;
+
+        *copied += (size_t)bytes_read;
+        // Only the final read may come up short; anything else would break the alignment of the next one.
+        if ((size_t)bytes_read % STRATEGY_DIRECT_ALIGN != 0) break;
+    }
+    // Filesystems that accept O_DIRECT at open but not for this file fail the read with EINVAL.
+    if (bytes_read < 0) err = errno == EINVAL ? STRATEGY_FALLBACK : errno;
+
+    free(buffer);
+    close(fd);
+    return err;
+#else
+    (void)src; (void)dest_fds; (void)dest_count; (void)dest_errors; (void)healthy; (void)copied; (void)dests;
+    return STRATEGY_FALLBACK;
+#endif
+}
+
+// Resolves dest through the worker's directory cache when it has one, so only the leaf is looked up.
+static int dest_parent(dir_cache_t* dirs, const char* dest, const char** leaf) {
+    if (!dirs) {
+        *leaf = dest;
+        return AT_FDCWD;
+    }
+    return dir_cache_resolve(dirs, dest, leaf);
+}
+
 #endif 
 
 size_t calculate_buffer_size(size_t file_size) {
@@ -176,21 +374,33 @@ size_t calculate_buffer_size(size_t file_size) {
     return (buffer_size + 63) & ~63;
 }
 
-int copy_file(const char* src, const char* dest, worker_stats_t* thread_stat, size_t buff_size) {
+int copy_file(const char* src, const char* dest, worker_stats_t* thread_stat, size_t buff_size, dir_cache_t* dirs) {
+    int dest_error = 0;
+    return copy_file_multi(src, &dest, 1, &dest_error, thread_stat, buff_size, dirs);
+}
+
+int copy_file_multi(const char* src, const char* const* dests, int dest_count, int* dest_errors, worker_stats_t* thread_stat, size_t buff_size, dir_cache_t* dirs) {
 #ifdef _WIN32
-    HANDLE destination_file = INVALID_HANDLE_VALUE; 
+    HANDLE destination_files[MAX_DESTINATIONS];
     char* buffer = NULL;
     file_lock_t *source_lock = NULL;
     DWORD error_code = 0;
     size_t total_bytes_copied = 0;
+    int healthy = 0;
 
-    wchar_t *destW = utf8_to_wide(dest);
-    if (!destW) return 1;
+    (void)dirs;
+    for (int k = 0; k < dest_count; ++k) {
+        destination_files[k] = INVALID_HANDLE_VALUE;
+        dest_errors[k] = 0;
+    }
+
+    double span_start = TRACE_BEGIN();
 
     source_lock = malloc(sizeof(file_lock_t));
     if (!source_lock) { error_code = ERROR_NOT_ENOUGH_MEMORY; goto cleanup; }
     source_lock->handle = INVALID_HANDLE_VALUE;
     
+    if (throttle_enabled) throttle_open();
     if (lock_file(source_lock, src) != 0) {
         fprintf(stderr, RED "copy_file error : Cannot lock source file \"%s\"\n" RESET, src);
 
@@ -198,22 +408,39 @@ int copy_file(const char* src, const char* dest, worker_stats_t* thread_stat, si
         goto cleanup;
     }
 
-    destination_file = CreateFileW(
-        destW,
-        GENERIC_WRITE,
-        0, 
-        NULL,
-        CREATE_NEW, 
-        FILE_ATTRIBUTE_NORMAL,
-        NULL
-    );
-    if (destination_file == INVALID_HANDLE_VALUE) {
-        error_code = GetLastError();
-        fprintf(stderr, RED "copy_file error : Cannot open destination file \"%s\", err code: \"%lu\"\n" RESET, dest, error_code);
+    for (int k = 0; k < dest_count; ++k) {
+        wchar_t *destW = utf8_to_wide(dests[k]);
+        if (!destW) {
+            dest_errors[k] = ERROR_OUTOFMEMORY;
+            continue;
+        }
 
+        destination_files[k] = CreateFileW(
+            destW,
+            GENERIC_WRITE,
+            0, 
+            NULL,
+            CREATE_NEW, 
+            FILE_ATTRIBUTE_NORMAL,
+            NULL
+        );
+        free(destW);
+
+        if (destination_files[k] == INVALID_HANDLE_VALUE) {
+            dest_errors[k] = GetLastError();
+            fprintf(stderr, RED "copy_file error : Cannot open destination file \"%s\", err code: \"%d\"\n" RESET, dests[k], dest_errors[k]);
+            continue;
+        }
+        ++healthy;
+    }
+    if (healthy == 0) {
+        error_code = dest_errors[0];
         goto cleanup;
     }
+    TRACE_END(TRACE_OPEN, span_start, 0);
+    span_start = TRACE_BEGIN();
 
+    buff_size = throttle_chunk(buff_size);
     buffer = (char*)malloc(buff_size);
     if (buffer == NULL) {
         error_code = ERROR_NOT_ENOUGH_MEMORY;
@@ -232,17 +459,51 @@ int copy_file(const char* src, const char* dest, worker_stats_t* thread_stat, si
         }
         if (bytes_readed == 0) break;      
 
-        DWORD write_err = write_all(destination_file, buffer, bytes_readed);
-        if (write_err != 0) {
-            error_code = write_err;
-            fprintf(stderr, RED "copy_file error: Write failed for \"%s\", error code: %lu\n" RESET, dest, error_code);
-            break; 
+        double write_start = 0;
+        if (throttle_enabled) {
+            throttle_read((size_t)bytes_readed);
+            throttle_write((size_t)bytes_readed * (size_t)healthy);
+            write_start = monotonic_seconds();
+        }
+
+        // Each chunk is read once and written to every destination that is still healthy.
+        for (int k = 0; k < dest_count; ++k) {
+            if (destination_files[k] == INVALID_HANDLE_VALUE || dest_errors[k] != 0) continue;
+
+            DWORD write_err = write_all(destination_files[k], buffer, bytes_readed);
+            if (write_err != 0) {
+                dest_errors[k] = write_err;
+                --healthy;
+                fprintf(stderr, RED "copy_file error: Write failed for \"%s\", error code: %lu\n" RESET, dests[k], write_err);
+            }
         }
+        if (throttle_enabled) throttle_write_done((size_t)bytes_readed * (size_t)healthy, monotonic_seconds() - write_start);
+        if (healthy == 0) break;
 
         total_bytes_copied += (size_t)bytes_readed;
     }
+    TRACE_END(TRACE_COPY, span_start, total_bytes_copied);
+
+    if (error_code == 0 && sync_mode == SYNC_FILE) {
+        double sync_start = monotonic_seconds();
+        for (int k = 0; k < dest_count; ++k) {
+            if (destination_files[k] == INVALID_HANDLE_VALUE || dest_errors[k] != 0) continue;
+
+            if (!FlushFileBuffers(destination_files[k])) {
+                dest_errors[k] = GetLastError();
+                fprintf(stderr, RED "copy_file error: FlushFileBuffers failed for \"%s\", error code: %lu\n" RESET, dests[k], (unsigned long)dest_errors[k]);
+            }
+        }
+        thread_stat->sync_seconds += monotonic_seconds() - sync_start;
+    }
 
 cleanup:
+    span_start = TRACE_BEGIN();
+
+    for (int k = 0; k < dest_count; ++k) {
+        if (error_code != 0 && dest_errors[k] == 0) dest_errors[k] = error_code;
+        if (error_code == 0 && dest_errors[k] != 0) error_code = dest_errors[k];
+    }
 
     if (error_code == 0) {
         ++thread_stat->total_files;
@@ -252,10 +513,12 @@ cleanup:
     unlock_file(source_lock);
     free(source_lock);
 
-    if (destination_file != INVALID_HANDLE_VALUE) CloseHandle(destination_file);
+    for (int k = 0; k < dest_count; ++k) {
+        if (destination_files[k] != INVALID_HANDLE_VALUE) CloseHandle(destination_files[k]);
+    }
 
     free(buffer);
-    free(destW);
+    TRACE_END(TRACE_CLOSE, span_start, 0);
 
     return error_code;
 
@@ -263,15 +526,22 @@ cleanup:
     int error_code = 0;
     size_t total_bytes_copied = 0;
     file_lock_t* source_lock = NULL;
-    int src_fd = -1;
-    int dest_fd = -1;
-    char* buffer = NULL;
+    int dest_fds[MAX_DESTINATIONS];
+    int healthy = 0;
     struct stat src_stat;
 
+    for (int k = 0; k < dest_count; ++k) {
+        dest_fds[k] = -1;
+        dest_errors[k] = 0;
+    }
+
+    double span_start = TRACE_BEGIN();
+
     source_lock = malloc(sizeof(file_lock_t));
     if (!source_lock) { error_code = 1; goto cleanup; }
     source_lock->fd = -1;
 
+    if (throttle_enabled) throttle_open();
     if (lock_file(source_lock, src) != 0) {
         fprintf(stderr, RED "copy_file error: Cannot lock source file \"%s\"\n" RESET, src);
         error_code = errno;
@@ -284,39 +554,102 @@ cleanup:
         goto cleanup;
     }
 
-    dest_fd = open(dest, O_WRONLY | O_CREAT | O_EXCL, src_stat.st_mode);
-    if (dest_fd == -1) {
-        fprintf(stderr, RED "copy_file error: Cannot open destination file \"%s\"\n" RESET, dest);
-        error_code = errno;
-        goto cleanup;
+    for (int k = 0; k < dest_count; ++k) {
+        const char* dest_leaf = NULL;
+        int dest_dir_fd = dest_parent(dirs, dests[k], &dest_leaf);
+        dest_fds[k] = dest_dir_fd == -1 ? -1 : openat(dest_dir_fd, dest_leaf, O_WRONLY | O_CREAT | O_EXCL, src_stat.st_mode);
+        if (dest_fds[k] == -1) {
+            fprintf(stderr, RED "copy_file error: Cannot open destination file \"%s\"\n" RESET, dests[k]);
+            dest_errors[k] = errno;
+            continue;
+        }
+        ++healthy;
     }
-
-    buffer = malloc(buff_size);
-    if (!buffer) {
-        fprintf(stderr, RED "copy_file error: Cannot allocate buffer memory for file \"%s\"\n" RESET, src);
-        error_code = ENOMEM;
+    if (healthy == 0) {
+        error_code = dest_errors[0];
         goto cleanup;
     }
+    TRACE_END(TRACE_OPEN, span_start, 0);
+    span_start = TRACE_BEGIN();
+
+    size_t file_size = (size_t)src_stat.st_size;
+    copy_strategy_t strategy = strategy_pick(file_size, dest_count);
+    double copy_start = monotonic_seconds();
+    int copy_err = STRATEGY_FALLBACK;
+
+    switch (strategy) {
+    case STRATEGY_MMAP:
+        copy_err = copy_mmap(source_lock->fd, file_size, dest_fds, dest_count, dest_errors, &healthy, &total_bytes_copied, dests);
+        break;
+    case STRATEGY_KERNEL:
+        copy_err = copy_kernel(source_lock->fd, dest_fds[0], file_size, &dest_errors[0], &healthy, &total_bytes_copied);
+        break;
+    case STRATEGY_DIRECT:
+        copy_err = copy_direct(src, dest_fds, dest_count, dest_errors, &healthy, &total_bytes_copied, dests);
+        break;
+    default:
+        break;
+    }
 
-    ssize_t bytes_read = 0;
-    while ((bytes_read = read(source_lock->fd, buffer, buff_size)) > 0) {
-        ssize_t bytes_written = write(dest_fd, buffer, bytes_read);
-        
-        if (bytes_written != bytes_read) {
-            fprintf(stderr, RED "copy_file error: Write failed for \"%s\"\n" RESET, dest);
-            error_code = errno;
-            break;
+    // Bytes a special path copied before giving up. Such a mixed run is not a clean sample for either strategy.
+    size_t handed_over = 0;
+    if (copy_err == STRATEGY_FALLBACK) {
+        // A special path that gave up hands over at total_bytes_copied; the destinations are already there.
+        if (strategy == STRATEGY_MMAP || strategy == STRATEGY_KERNEL || strategy == STRATEGY_DIRECT) {
+            strategy_fallback(file_size, strategy);
+            strategy = STRATEGY_BUFFERED;
+            handed_over = total_bytes_copied;
+            if (lseek(source_lock->fd, (off_t)total_bytes_copied, SEEK_SET) == -1) copy_err = errno;
         }
-        
-        total_bytes_copied += bytes_written;
+    }
+    if (copy_err == STRATEGY_FALLBACK) {
+        copy_err = copy_buffered(source_lock->fd, dest_fds, dest_count, dest_errors, &healthy, throttle_chunk(strategy_buffer_size(strategy, buff_size)), &total_bytes_copied, dests);
     }
 
-    if (bytes_read < 0) {
+    if (copy_err != 0 && copy_err != STRATEGY_FALLBACK) {
         fprintf(stderr, RED "copy_file error: Read failed for \"%s\"\n" RESET, src);
-        error_code = errno;
+        error_code = copy_err;
+    } else if (healthy == dest_count && handed_over == 0) {
+        strategy_record(file_size, strategy, total_bytes_copied, monotonic_seconds() - copy_start);
+    }
+    TRACE_END(TRACE_COPY, span_start, total_bytes_copied);
+
+    if (error_code == 0) {
+        // Keep the source mode, which the umask filtered at create time, and the source timestamps,
+        // so the copy does not look newer than its original.
+        struct timespec times[2] = { src_stat.st_atim, src_stat.st_mtim };
+        for (int k = 0; k < dest_count; ++k) {
+            if (dest_fds[k] == -1 || dest_errors[k] != 0) continue;
+
+            if (fchmod(dest_fds[k], src_stat.st_mode & 07777) != 0) {
+                fprintf(stderr, YEL "copy_file warning: Cannot set mode of \"%s\"\n" RESET, dests[k]);
+            }
+            if (futimens(dest_fds[k], times) != 0) {
+                fprintf(stderr, YEL "copy_file warning: Cannot set timestamps of \"%s\"\n" RESET, dests[k]);
+            }
+        }
+    }
+
+    if (error_code == 0 && sync_mode == SYNC_FILE) {
+        double sync_start = monotonic_seconds();
+        for (int k = 0; k < dest_count; ++k) {
+            if (dest_fds[k] == -1 || dest_errors[k] != 0) continue;
+
+            if (fdatasync(dest_fds[k]) != 0) {
+                fprintf(stderr, RED "copy_file error: fdatasync failed for \"%s\"\n" RESET, dests[k]);
+                dest_errors[k] = errno;
+            }
+        }
+        thread_stat->sync_seconds += monotonic_seconds() - sync_start;
     }
 
 cleanup:
+    span_start = TRACE_BEGIN();
+
+    for (int k = 0; k < dest_count; ++k) {
+        if (error_code != 0 && dest_errors[k] == 0) dest_errors[k] = error_code;
+        if (error_code == 0 && dest_errors[k] != 0) error_code = dest_errors[k];
+    }
     
     if (error_code == 0) {
         ++thread_stat->total_files;
@@ -330,28 +663,227 @@ cleanup:
         free(source_lock);
     }
 
-    if (dest_fd != -1) {
-        close(dest_fd);
+    for (int k = 0; k < dest_count; ++k) {
+        if (dest_fds[k] != -1) close(dest_fds[k]);
     }
 
-    free(buffer);
+    TRACE_END(TRACE_CLOSE, span_start, 0);
+
+    return error_code;
+#endif
+}
+
+int copy_symlink(const char* src, const char* dest, worker_stats_t* thread_stat, dir_cache_t* dirs) {
+#ifdef _WIN32
+    (void)src; (void)dest; (void)thread_stat; (void)dirs;
+    return ERROR_NOT_SUPPORTED;
+#else //POSIX
+    char target[MAX_PATH];
+
+    ssize_t len = readlink(src, target, sizeof(target));
+    if (len < 0) {
+        fprintf(stderr, RED "copy_symlink error: Cannot read link \"%s\"\n" RESET, src);
+        return errno;
+    }
+    if ((size_t)len >= sizeof(target)) {
+        fprintf(stderr, RED "copy_symlink error: Link target of \"%s\" is too long\n" RESET, src);
+        return ENAMETOOLONG;
+    }
+    target[len] = '\0';
+
+    const char* leaf = NULL;
+    int dir_fd = dest_parent(dirs, dest, &leaf);
+    if (dir_fd == -1 || symlinkat(target, dir_fd, leaf) != 0) {
+        fprintf(stderr, RED "copy_symlink error: Cannot create link \"%s\" -> \"%s\"\n" RESET, dest, target);
+        return errno;
+    }
+
+    ++thread_stat->total_links;
+    return 0;
+#endif
+}
+
+int link_file(const char* target, const char* dest, worker_stats_t* thread_stat, dir_cache_t* dirs) {
+#ifdef _WIN32
+    (void)dirs;
+    wchar_t *targetW = utf8_to_wide(target);
+    wchar_t *destW = utf8_to_wide(dest);
+    DWORD error_code = 0;
+
+    if (!targetW || !destW) error_code = ERROR_OUTOFMEMORY;
+    else if (!CreateHardLinkW(destW, targetW, NULL)) error_code = GetLastError();
+
+    free(targetW);
+    free(destW);
+
+    if (error_code == 0) ++thread_stat->total_links;
+    return error_code;
+#else //POSIX
+    const char* leaf = NULL;
+    int dir_fd = dest_parent(dirs, dest, &leaf);
+    if (dir_fd == -1 || linkat(AT_FDCWD, target, dir_fd, leaf, 0) != 0) return errno;
+
+    ++thread_stat->total_links;
+    return 0;
+#endif
+}
+
+int make_directory(const char* dest, dir_cache_t* dirs) {
+#ifdef _WIN32
+    (void)dirs;
+    wchar_t *destW = utf8_to_wide(dest);
+    if (!destW) return ERROR_OUTOFMEMORY;
+
+    DWORD error_code = 0;
+    if (!CreateDirectoryW(destW, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) error_code = GetLastError();
+
+    free(destW);
+    return error_code;
+#else //POSIX
+    const char* leaf = NULL;
+    int dir_fd = dest_parent(dirs, dest, &leaf);
+    if (dir_fd == -1) return errno;
+
+    if (mkdirat(dir_fd, leaf, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, RED "make_directory: failed to create directory %s: %s\n" RESET, dest, strerror(errno));
+        return errno;
+    }
+    return 0;
+#endif
+}
+
+int remove_source(const char* path) {
+#ifdef _WIN32
+    wchar_t *pathW = utf8_to_wide(path);
+    if (!pathW) return ERROR_OUTOFMEMORY;
+
+    DWORD error_code = DeleteFileW(pathW) ? 0 : GetLastError();
+    free(pathW);
 
     return error_code;
+#else //POSIX
+    return unlink(path) == 0 ? 0 : errno;
 #endif
 }
 
+char* destination_path(const destination_set_t* dests, int index, const char* primary_path) {
+    const char* rel = primary_path + dests->primary_len;
+    size_t len = strlen(dests->roots[index]) + strlen(rel) + 1;
+
+    char* path = malloc(len);
+    if (path) snprintf(path, len, "%s%s", dests->roots[index], rel);
+
+    return path;
+}
+
+static int run_task(thread_context_t* cont, copy_task_t* task) {
+    const destination_set_t* dests = cont->dests;
+    int dest_count = dests ? dests->count : 1;
+    char* paths[MAX_DESTINATIONS] = {0};
+    int errors[MAX_DESTINATIONS] = {0};
+    int res = 0;
+
+    paths[0] = task->dest_path;
+    for (int k = 1; k < dest_count; ++k) {
+        paths[k] = destination_path(dests, k, task->dest_path);
+        if (!paths[k]) {
+            for (int j = 1; j < k; ++j) free(paths[j]);
+            if (task->inode && task->kind == TASK_COPY) inode_map_settle(cont->links, task->inode, INODE_FAILED);
+            return ENOMEM;
+        }
+    }
+
+    // --pack: small files (every path of a small hardlinked inode included) go into the worker's pack.
+    int packed = cont->pack && (task->kind == TASK_COPY || task->kind == TASK_HARDLINK) && task->file_size < cont->pack->threshold;
+
+    if (packed) {
+        errors[0] = pack_file(cont->pack, &cont->pack_writer, cont->id, task->source_path, task->dest_path, cont->stats);
+        if (task->inode && task->kind == TASK_COPY) inode_map_settle(cont->links, task->inode, errors[0] == 0 ? INODE_DONE : INODE_FAILED);
+    } else switch (task->kind) {
+    case TASK_MKDIR:
+        for (int k = 0; k < dest_count; ++k) errors[k] = make_directory(paths[k], cont->dirs);
+        break;
+
+    case TASK_REFRESH:
+        refresh_entry(task->source_path, paths, dest_count, errors, cont->stats, task->buffer_size, cont->id);
+        break;
+
+    case TASK_SYMLINK:
+        for (int k = 0; k < dest_count; ++k) errors[k] = copy_symlink(task->source_path, paths[k], cont->stats, cont->dirs);
+        break;
+
+    case TASK_HARDLINK: {
+        // The first path of this inode is copied by whichever worker popped it; link to it once it lands.
+        int linkable = inode_map_wait(cont->links, task->inode) == INODE_DONE;
+
+        for (int k = 0; k < dest_count; ++k) {
+            if (linkable) {
+                char* target = k == 0 ? task->inode->dest_path : destination_path(dests, k, task->inode->dest_path);
+                errors[k] = target ? link_file(target, paths[k], cont->stats, cont->dirs) : ENOMEM;
+                if (k > 0) free(target);
+                if (errors[k] == 0) continue;
+            }
+            errors[k] = copy_file(task->source_path, paths[k], cont->stats, task->buffer_size, cont->dirs);
+        }
+        break;
+    }
+
+    default: {
+        double file_start = TRACE_BEGIN();
+        copy_file_multi(task->source_path, (const char* const*)paths, dest_count, errors, cont->stats, task->buffer_size, cont->dirs);
+        if (task->inode) {
+            int copied = TRUE;
+            for (int k = 0; k < dest_count; ++k) copied = copied && errors[k] == 0;
+            inode_map_settle(cont->links, task->inode, copied ? INODE_DONE : INODE_FAILED);
+        }
+        TRACE_END(TRACE_FILE, file_start, task->file_size);
+        break;
+    }
+    }
+
+    for (int k = 0; k < dest_count; ++k) {
+        if (errors[k] == 0) continue;
+
+        ++cont->stats->dest_failures[k];
+        if (res == 0) res = errors[k];
+        if (k > 0) fprintf(stderr, RED "worker #%d error : Cannot replicate \"%s\" to \"%s\", err code: %d\n" RESET, cont->id, task->source_path, paths[k], errors[k]);
+    }
+
+    for (int k = 1; k < dest_count; ++k) free(paths[k]);
+
+    if (cont->syncer && res == 0 && task->kind != TASK_MKDIR) syncer_file_done(cont->syncer);
+
+    // --move across devices: the source goes away only after every destination has its copy.
+    if (cont->move && res == 0 && task->kind != TASK_MKDIR) {
+        int err = remove_source(task->source_path);
+        if (err == 0) note_moved(task->source_path);
+        else fprintf(stderr, RED "worker #%d error : Cannot remove moved source \"%s\", err code: %d\n" RESET, cont->id, task->source_path, err);
+    }
+
+    return res;
+}
+
 void* worker_thread(void* arg) {
     thread_context_t *cont = (thread_context_t*)arg;
     copy_task_t current_tasks_batck[WORKER_BATCH_SIZE];
+
+    dir_cache_t dirs;
+    dir_cache_init(&dirs);
+    cont->dirs = &dirs;
+
+    trace_thread_name("worker", cont->id);
+
     for (;;) {
         int batch_count = queue_pop_batch(cont->queue, current_tasks_batck, WORKER_BATCH_SIZE);
         if ( batch_count < 0) {
             fprintf(stdout, GRN "worker #%d finished work\n" RESET, cont->id);
+            cont->dirs = NULL;
+            dir_cache_close(&dirs);
             pthread_exit((void*)0);
         }
 
         for (int i = 0; i < batch_count; ++i) {
-            int res = copy_file(current_tasks_batck[i].source_path, current_tasks_batck[i].dest_path, cont->stats, current_tasks_batck[i].buffer_size);
+            int res = run_task(cont, &current_tasks_batck[i]);
             if (res != 0) {
                 fprintf(
                     stderr, RED "worker #%d error : Cannot copy \"%s\" in \"%s\", err code: %d \n" RESET, 
@@ -367,21 +899,110 @@ void* worker_thread(void* arg) {
 
 void* producer_thread(void* arg) {
     producer_context_t* cont = (producer_context_t*)arg;
+    trace_thread_name("producer", cont->id);
+
+    int res = 0;
+    if (cont->list_path) {
+        res = scan_file_list(cont->list_path, cont->null_separated, cont->src_dir, cont->dest_dir, cont->pools, cont->links, cont->filter, cont->files_counter);
+        fprintf(res == 0 ? stdout : stderr, "producer #%d: scan_file_list terminated with code %d\n", cont->id, res);
+    } else {
+        res = scan_directory(cont->src_dir, cont->dest_dir, cont->pools, cont->links, cont->filter, cont->files_counter);
+        fprintf(res == 0 ? stdout : stderr, "producer #%d: scan_directory terminated with code %d\n", cont->id, res);
+    }
 
-    int res = scan_directory(cont->src_dir, cont->dest_dir, cont->queue, cont->filter, cont->files_counter);
-
-    fprintf(res == 0 ? stdout : stderr, "producer #%d: scan_directory terminated with code %d\n", cont->id, res);
+    // Workers stay up while watching; the pools are shut down only once the watch is stopped.
+    if (cont->watch && res == 0) {
+        res = watch_run(cont->watch, cont->pools);
+        fprintf(res == 0 ? stdout : stderr, "producer #%d: watch_run terminated with code %d\n", cont->id, res);
+    }
 
-    pthread_mutex_lock(&cont->queue->mutex);
-    cont->queue->shutdown = -1;
-    pthread_cond_broadcast(&cont->queue->not_empty);
-    pthread_mutex_unlock(&cont->queue->mutex);
+    device_pools_shutdown(cont->pools);
 
     return NULL;
 }
 
-int scan_directory(const char* src, const char* dest, task_queue_t* queue, const char* filter, size_t* files_counter) {
+// Frees a task that will never reach a worker. A copy that claimed its inode settles it as failed,
+// so hardlinks queued elsewhere stop waiting and fall back to copying.
+static void drop_task(device_pools_t* pools, copy_task_t* task) {
+    if (task->inode && task->kind == TASK_COPY) inode_map_settle(pools->links, task->inode, INODE_FAILED);
+    free(task->source_path);
+    free(task->dest_path);
+}
+
+// Hands a full batch to the pool serving dev. On failure the batch is freed and an error code returned.
+int flush_batch(device_pools_t* pools, unsigned long long dev, copy_task_t* tasks_batch, size_t* batch_count) {
+    if (*batch_count == 0) return 0;
+
+    if (device_pools_submit(pools, dev, tasks_batch, (int)*batch_count) != 0) {
+        for (size_t i = 0; i < *batch_count; ++i) drop_task(pools, &tasks_batch[i]);
+        *batch_count = 0;
+        return -1;
+    }
+
+    *batch_count = 0;
+    return 0;
+}
+
+// Appends task to the batch, flushing first when the batch belongs to another device or is full.
+int push_task(device_pools_t* pools, copy_task_t* tasks_batch, size_t* batch_count, unsigned long long* batch_dev, copy_task_t task, unsigned long long dev) {
+    if (*batch_count > 0 && *batch_dev != dev && flush_batch(pools, *batch_dev, tasks_batch, batch_count) != 0) {
+        drop_task(pools, &task);
+        return -1;
+    }
+
+    tasks_batch[(*batch_count)++] = task;
+    *batch_dev = dev;
+
+    if (*batch_count >= BATCH_SIZE) return flush_batch(pools, dev, tasks_batch, batch_count);
+    return 0;
+}
+
+#ifndef _WIN32
+// Builds the task for one lstat()ed source entry: mkdir for directories, symlink for links,
+// hardlink for every path of a multiply-linked inode after the first, plain copy otherwise.
+static int make_task(const char* src_path, const char* dest_path, const struct stat* st, inode_map_t* links, copy_task_t* task) {
+    memset(task, 0, sizeof(*task));
+    task->source_path = strdup(src_path);
+    task->dest_path = strdup(dest_path);
+
+    if (!task->source_path || !task->dest_path) {
+        free(task->source_path);
+        free(task->dest_path);
+        return ENOMEM;
+    }
+
+    if (S_ISDIR(st->st_mode)) {
+        task->kind = TASK_MKDIR;
+        return 0;
+    }
+
+    task->kind = TASK_COPY;
+    task->buffer_size = calculate_buffer_size((size_t)st->st_size);
+    task->file_size = S_ISREG(st->st_mode) ? (size_t)st->st_size : 0;
+    task->ino = (unsigned long long)st->st_ino;
+
+    if (S_ISLNK(st->st_mode)) {
+        task->kind = TASK_SYMLINK;
+    } else if (links && st->st_nlink > 1) {
+        int is_new = FALSE;
+        task->inode = inode_map_claim(links, (unsigned long long)st->st_dev, (unsigned long long)st->st_ino, dest_path, &is_new);
+        if (!task->inode) {
+            free(task->source_path);
+            free(task->dest_path);
+            return ENOMEM;
+        }
+        if (!is_new) task->kind = TASK_HARDLINK;
+    }
+
+    return 0;
+}
+#endif
+
+int scan_directory(const char* src, const char* dest, device_pools_t* pools, inode_map_t* links, const char* filter, size_t* files_counter) {
 #ifdef _WIN32
+    double span_start = TRACE_BEGIN();
+    size_t entries = 0;
+
     int err_code = 0;
     WIN32_FIND_DATAW foundet_data = {0};
     HANDLE h = INVALID_HANDLE_VALUE;
@@ -433,6 +1054,7 @@ int scan_directory(const char* src, const char* dest, task_queue_t* queue, const
 
     do {
         if (wcscmp(foundet_data.cFileName, L".") == 0 || wcscmp(foundet_data.cFileName, L"..") == 0) continue;
+        ++entries;
 
         swprintf(src_pathW, MAX_PATH, L"%s\\%s", srcW, foundet_data.cFileName);
         swprintf(dst_pathW, MAX_PATH, L"%s\\%s", destW, foundet_data.cFileName);
@@ -443,15 +1065,19 @@ int scan_directory(const char* src, const char* dest, task_queue_t* queue, const
         if (foundet_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
             CreateDirectoryW(dst_pathW, NULL);
 
-            err_code = scan_directory(src_path, dest_path, queue, filter, files_counter);
+            TRACE_END(TRACE_SCAN_DIR, span_start, entries);
+            entries = 0;
+            err_code = scan_directory(src_path, dest_path, pools, links, filter, files_counter);
+            span_start = TRACE_BEGIN();
             if (err_code != 0) goto cleanup;
         } else {
             ++*files_counter;
 
             if (check_extension(src_path, filter)) {
-                copy_task_t task;
+                copy_task_t task = {0};
 
                 ULONGLONG src_size = ((ULONGLONG)foundet_data.nFileSizeHigh << 32) | foundet_data.nFileSizeLow;
+                task.file_size = (size_t)src_size;
                 task.buffer_size = calculate_buffer_size((size_t)src_size);
 
                 task.source_path = wide_to_utf8(src_pathW);
@@ -459,9 +1085,11 @@ int scan_directory(const char* src, const char* dest, task_queue_t* queue, const
 
                 tasks_batch[batch_count++] = task;
 
-                if (batch_count >= BATCH_SIZE) {
-                    queue_enqueue_batch(queue, tasks_batch, batch_count);
-                    batch_count = 0;
+                if (batch_count >= BATCH_SIZE && flush_batch(pools, 0, tasks_batch, &batch_count) != 0) {
+                    err_code = ERROR_OUTOFMEMORY;
+                    free(src_path);
+                    free(dest_path);
+                    goto cleanup;
                 }
             }
         }
@@ -469,10 +1097,7 @@ int scan_directory(const char* src, const char* dest, task_queue_t* queue, const
         free(dest_path);
     } while (FindNextFileW(h, &foundet_data));
 
-    if (batch_count != 0) {
-        queue_enqueue_batch(queue, tasks_batch, batch_count);
-        batch_count = 0;
-    }
+    if (flush_batch(pools, 0, tasks_batch, &batch_count) != 0) err_code = ERROR_OUTOFMEMORY;
 
 cleanup:
     free(srcW);
@@ -483,8 +1108,13 @@ cleanup:
 
     if (h != INVALID_HANDLE_VALUE) FindClose(h);
 
+    TRACE_END(TRACE_SCAN_DIR, span_start, entries);
+
     return err_code;
 #else //POSIX
+    double span_start = TRACE_BEGIN();
+    size_t entries = 0;
+
     DIR *dir = opendir(src);
     if (!dir) return errno;
 
@@ -493,6 +1123,7 @@ cleanup:
 
     copy_task_t *tasks_batch = NULL;
     size_t batch_count = 0;
+    unsigned long long batch_dev = 0;
 
     char *src_path = NULL;
     char *dest_path = NULL;
@@ -505,6 +1136,7 @@ cleanup:
 
     while ((entry = readdir(dir))) {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        ++entries;
 
         size_t src_len = snprintf(NULL, 0, "%s/%s", src, entry->d_name) + 1;
         size_t dest_len = snprintf(NULL, 0, "%s/%s", dest, entry->d_name) + 1;
@@ -527,12 +1159,21 @@ cleanup:
         }
 
         if (S_ISDIR(st.st_mode)) {
-            if (mkdir(dest_path, 0755) == -1 && errno != EEXIST) {
-                fprintf(stderr, RED "scan_directory: failed to create directory %s: %s\n" RESET, dest_path, strerror(errno));
-                err_code = errno;
+            // Directories are created by the workers; files that race ahead create their parents lazily.
+            copy_task_t task;
+            err_code = make_task(src_path, dest_path, &st, links, &task);
+            if (err_code != 0) goto cleanup;
+
+            if (push_task(pools, tasks_batch, &batch_count, &batch_dev, task, (unsigned long long)st.st_dev) != 0) {
+                err_code = ENOMEM;
                 goto cleanup;
             }
-            err_code = scan_directory(src_path, dest_path, queue, filter, files_counter);
+
+            // The span is cut around the recursion, so subdirectory scans are not counted twice.
+            TRACE_END(TRACE_SCAN_DIR, span_start, entries);
+            entries = 0;
+            err_code = scan_directory(src_path, dest_path, pools, links, filter, files_counter);
+            span_start = TRACE_BEGIN();
             if (err_code != 0) {
                 goto cleanup;
             }
@@ -540,33 +1181,19 @@ cleanup:
             ++*files_counter;
 
             if (check_extension(src_path, filter)) {
-                copy_task_t task = {
-                    .source_path = strdup(src_path),
-                    .dest_path = strdup(dest_path),
-                    .buffer_size = calculate_buffer_size((size_t)st.st_size)
-                };
+                copy_task_t task;
+                err_code = make_task(src_path, dest_path, &st, links, &task);
+                if (err_code != 0) goto cleanup;
                 
-                if (!task.source_path || !task.dest_path) {
-                    free(task.source_path);
-                    free(task.dest_path);
+                if (push_task(pools, tasks_batch, &batch_count, &batch_dev, task, (unsigned long long)st.st_dev) != 0) {
                     err_code = ENOMEM;
-
                     goto cleanup;
                 }
-                
-                tasks_batch[batch_count++] = task;
-
-                if (batch_count >= BATCH_SIZE) {
-                    queue_enqueue_batch(queue, tasks_batch, batch_count);
-                    batch_count = 0;
-                }
             }
         }
     }
 
-    if (batch_count > 0) {
-        queue_enqueue_batch(queue, tasks_batch, batch_count);
-    }
+    if (flush_batch(pools, batch_dev, tasks_batch, &batch_count) != 0) err_code = ENOMEM;
 
 cleanup:
     closedir(dir);
@@ -575,6 +1202,149 @@ cleanup:
     free(dest_path);
     free(tasks_batch);
 
+    TRACE_END(TRACE_SCAN_DIR, span_start, entries);
+
+    return err_code;
+#endif
+}
+
+#ifndef _WIN32
+typedef struct file_list_state_t {
+    const char* src;
+    const char* dest;
+    const char* filter;
+    device_pools_t* pools;
+    inode_map_t* links;
+    size_t* files_counter;
+
+    copy_task_t* tasks_batch;
+    size_t batch_count;
+    unsigned long long batch_dev;
+
+    char src_path[MAX_PATH];
+    char dest_path[MAX_PATH];
+} file_list_state_t;
+
+// True when one of the '/'-separated components of the len bytes at path is "..".
+static int has_parent_component(const char* path, size_t len) {
+    for (size_t start = 0; start < len; ) {
+        size_t end = start;
+        while (end < len && path[end] != '/') ++end;
+        if (end - start == 2 && path[start] == '.' && path[start + 1] == '.') return TRUE;
+        start = end + 1;
+    }
+    return FALSE;
+}
+
+static int list_entry(file_list_state_t* state, const char* rel, size_t len) {
+    while (len > 0 && (rel[len - 1] == '\r' || rel[len - 1] == '/')) --len;
+    while (len > 1 && rel[0] == '.' && rel[1] == '/') rel += 2, len -= 2;
+    if (len == 0) return 0;
+
+    // Entries must stay below both roots; with --move anything else would even be unlinked.
+    if (*rel == '/' || has_parent_component(rel, len)) {
+        fprintf(stderr, YEL "scan_file_list: skipping entry outside the source \"%.*s\"\n" RESET, (int)len, rel);
+        return 0;
+    }
+
+    int src_len = snprintf(state->src_path, sizeof(state->src_path), "%s/%.*s", state->src, (int)len, rel);
+    int dest_len = snprintf(state->dest_path, sizeof(state->dest_path), "%s/%.*s", state->dest, (int)len, rel);
+    if (src_len >= (int)sizeof(state->src_path) || dest_len >= (int)sizeof(state->dest_path)) {
+        fprintf(stderr, RED "scan_file_list: path too long \"%.*s\"\n" RESET, (int)len, rel);
+        return 0;
+    }
+
+    struct stat st;
+    if (lstat(state->src_path, &st) == -1) {
+        fprintf(stderr, RED "scan_file_list failed: cannot get information for file \"%s\", code: %d\n" RESET, state->src_path, errno);
+        return 0;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        ++*state->files_counter;
+        if (!check_extension(state->src_path, state->filter)) return 0;
+    }
+
+    copy_task_t task;
+    int err_code = make_task(state->src_path, state->dest_path, &st, state->links, &task);
+    if (err_code != 0) return err_code;
+
+    if (push_task(state->pools, state->tasks_batch, &state->batch_count, &state->batch_dev, task, (unsigned long long)st.st_dev) != 0) return ENOMEM;
+    return 0;
+}
+#endif
+
+int scan_file_list(const char* list_path, int null_separated, const char* src, const char* dest, device_pools_t* pools, inode_map_t* links, const char* filter, size_t* files_counter) {
+#ifdef _WIN32
+    (void)list_path; (void)null_separated; (void)src; (void)dest; (void)pools; (void)links; (void)filter; (void)files_counter;
+    fprintf(stderr, RED "scan_file_list: file lists are not supported on Windows\n" RESET);
+    return ERROR_NOT_SUPPORTED;
+#else //POSIX
+    char separator = null_separated ? '\0' : '\n';
+    int err_code = 0;
+
+    file_list_state_t* state = calloc(1, sizeof(file_list_state_t));
+    if (!state) return ENOMEM;
+
+    state->src = src;
+    state->dest = dest;
+    state->filter = filter;
+    state->pools = pools;
+    state->links = links;
+    state->files_counter = files_counter;
+    state->tasks_batch = calloc(BATCH_SIZE, sizeof(copy_task_t));
+    if (!state->tasks_batch) {
+        free(state);
+        return ENOMEM;
+    }
+
+    if (strcmp(list_path, "-") == 0) {
+        char* line = NULL;
+        size_t line_cap = 0;
+        ssize_t line_len = 0;
+
+        while (err_code == 0 && (line_len = getdelim(&line, &line_cap, separator, stdin)) > 0) {
+            if (line[line_len - 1] == separator) --line_len;
+            err_code = list_entry(state, line, (size_t)line_len);
+        }
+        free(line);
+    } else {
+        int fd = open(list_path, O_RDONLY);
+        struct stat list_stat;
+
+        if (fd == -1 || fstat(fd, &list_stat) != 0) {
+            fprintf(stderr, RED "scan_file_list: cannot open list \"%s\": %s\n" RESET, list_path, strerror(errno));
+            err_code = errno;
+        } else if (list_stat.st_size > 0) {
+            size_t size = (size_t)list_stat.st_size;
+            const char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (data == MAP_FAILED) {
+                fprintf(stderr, RED "scan_file_list: cannot map list \"%s\": %s\n" RESET, list_path, strerror(errno));
+                err_code = errno;
+            } else {
+                madvise((void*)data, size, MADV_SEQUENTIAL);
+
+                const char* cursor = data;
+                const char* end = data + size;
+                while (err_code == 0 && cursor < end) {
+                    const char* next = memchr(cursor, separator, (size_t)(end - cursor));
+                    if (!next) next = end;
+
+                    err_code = list_entry(state, cursor, (size_t)(next - cursor));
+                    cursor = next + 1;
+                }
+                munmap((void*)data, size);
+            }
+        }
+        if (fd != -1) close(fd);
+    }
+
+    if (flush_batch(pools, state->batch_dev, state->tasks_batch, &state->batch_count) != 0 && err_code == 0) err_code = ENOMEM;
+
+    free(state->tasks_batch);
+    free(state);
+
     return err_code;
 #endif
 }
@@ -606,4 +1376,17 @@ int is_empty(const char *s) {
         ++s;
     }
     return TRUE;
+}
+
+double monotonic_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else //POSIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
 }
\ No newline at end of file
@@ -11,6 +11,8 @@
 #define MIN_BUFFER ((size_t)4 * KILO_BYTE)
 #define MAX_BUFFER ((size_t)8 * MEGA_BYTE)
 
+#define MAX_DESTINATIONS 8
+
 #define BATCH_SIZE 32
 #define WORKER_BATCH_SIZE 16
 
@@ -47,6 +49,9 @@ wchar_t *utf8_to_wide(const char *utf8);
 char *wide_to_utf8(const wchar_t *wstr);
 
 DWORD write_all(HANDLE h, const char *buf, DWORD len);
+#else //POSIX
+// mkdir -p for the parent directory of path.
+int make_parents(const char* path);
 #endif
 
 typedef struct file_lock_t file_lock_t;
@@ -56,39 +61,99 @@ int unlock_file(file_lock_t* lock);
 int check_extension(const char *path, const char *filter);
 int is_empty(const char *s);
 
+double monotonic_seconds(void);
+
 typedef struct task_queue_t task_queue_t;
+typedef struct inode_map_t inode_map_t;
+typedef struct inode_entry_t inode_entry_t;
+typedef struct dir_cache_t dir_cache_t;
+typedef struct device_pools_t device_pools_t;
+typedef struct plan_t plan_t;
+typedef struct syncer_t syncer_t;
+typedef struct watch_t watch_t;
+typedef struct pack_t pack_t;
+typedef struct pack_writer_t pack_writer_t;
+typedef struct verify_t verify_t;
+
+typedef enum copy_task_kind_t {
+    TASK_COPY = 0,
+    TASK_SYMLINK,
+    TASK_HARDLINK,
+    TASK_MKDIR,
+    TASK_REFRESH
+} copy_task_kind_t;
 
 typedef struct copy_task_t {
     char* source_path;
     char* dest_path;
     size_t buffer_size;
+    size_t file_size;
+    // Source inode number from the scan's lstat(), 0 when unknown.
+    unsigned long long ino;
+    copy_task_kind_t kind;
+    inode_entry_t* inode;
 } copy_task_t;
 
 typedef struct worker_stats_t {
     size_t total_files;
     size_t total_bytes;
+    size_t total_links;
+    size_t dest_failures[MAX_DESTINATIONS];
+    double sync_seconds;
 } worker_stats_t;
 
+// Destination roots of a fan-out copy; tasks carry paths under roots[0] and the rest are derived from them.
+typedef struct destination_set_t {
+    const char* roots[MAX_DESTINATIONS];
+    size_t primary_len;
+    int count;
+} destination_set_t;
+
 typedef struct thread_context_t {
     int id;
     task_queue_t* queue;
+    inode_map_t* links;
+    dir_cache_t* dirs;
+    plan_t* plan;
+    const destination_set_t* dests;
+    int move;
+    syncer_t* syncer;
+    pack_t* pack;
+    pack_writer_t* pack_writer;
+    verify_t* verify;
     worker_stats_t* stats;
 } thread_context_t;
 
 typedef struct producer_context_t {
     int id;
     size_t* files_counter;
-    task_queue_t* queue;
+    device_pools_t* pools;
+    inode_map_t* links;
     const char *src_dir;
     const char *dest_dir;
     const char *filter;
+    const char *list_path;
+    int null_separated;
+    watch_t* watch;
 } producer_context_t;
 
 void* worker_thread(void* arg);
 void* producer_thread(void* arg);
 
-int copy_file(const char* src, const char* dest, worker_stats_t* thread_stat, size_t buff_size);
-int scan_directory(const char* src, const char* dest, task_queue_t* queue, const char* filter, size_t* files_counter);
+int copy_file(const char* src, const char* dest, worker_stats_t* thread_stat, size_t buff_size, dir_cache_t* dirs);
+int copy_file_multi(const char* src, const char* const* dests, int dest_count, int* dest_errors, worker_stats_t* thread_stat, size_t buff_size, dir_cache_t* dirs);
+char* destination_path(const destination_set_t* dests, int index, const char* primary_path);
+int remove_source(const char* path);
+int copy_symlink(const char* src, const char* dest, worker_stats_t* thread_stat, dir_cache_t* dirs);
+int link_file(const char* target, const char* dest, worker_stats_t* thread_stat, dir_cache_t* dirs);
+int make_directory(const char* dest, dir_cache_t* dirs);
+int scan_directory(const char* src, const char* dest, device_pools_t* pools, inode_map_t* links, const char* filter, size_t* files_counter);
+
+// Producer-side batching: tasks are grouped per source device and handed to that device's pool.
+int flush_batch(device_pools_t* pools, unsigned long long dev, copy_task_t* tasks_batch, size_t* batch_count);
+int push_task(device_pools_t* pools, copy_task_t* tasks_batch, size_t* batch_count, unsigned long long* batch_dev, copy_task_t task, unsigned long long dev);
+
+int scan_file_list(const char* list_path, int null_separated, const char* src, const char* dest, device_pools_t* pools, inode_map_t* links, const char* filter, size_t* files_counter);
 
 size_t calculate_buffer_size(size_t file_size);
 
@@ -0,0 +1,383 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "devicePools.h"
+#include "taskQueue.h"
+#include "prefetch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/sysmacros.h>
+#endif
+
+int device_pools_init(device_pools_t* pools) {
+    memset(pools, 0, sizeof(*pools));
+
+    pools->hdd_workers = DEFAULT_HDD_WORKERS;
+    pools->worker = worker_thread;
+
+    if (pthread_mutex_init(&pools->mutex, NULL) != 0) {
+        fprintf(stderr, RED "Cannot create mutex in device_pools_t\n" RESET);
+        return -1;
+    }
+    if (pthread_cond_init(&pools->drained, NULL) != 0) {
+        fprintf(stderr, RED "Cannot create condition variable in device_pools_t\n" RESET);
+        pthread_mutex_destroy(&pools->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+int device_pools_destroy(device_pools_t* pools) {
+    for (int p = 0; p < pools->count; ++p) {
+        device_pool_t* pool = &pools->pools[p];
+
+        for (int i = 0; i < pool->num_workers; ++i) free(pool->contexts[i].stats);
+        free(pool->window);
+        free(pool->spare);
+        free(pool->contexts);
+        free(pool->workers);
+        queue_destroy(pool->queue);
+    }
+    pools->count = 0;
+
+    pthread_cond_destroy(&pools->drained);
+    return pthread_mutex_destroy(&pools->mutex);
+}
+
+#ifdef __linux__
+
+static int read_sysfs_int(const char* path, int* out) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+
+    int ok = fscanf(f, "%d", out) == 1;
+    fclose(f);
+
+    return ok ? 0 : -1;
+}
+
+// Partitions have no queue/ or device/ of their own, so fall back to the parent disk's attributes.
+static int block_attr(unsigned long long dev, const char* attr) {
+    char path[MAX_PATH];
+    int value = -1;
+
+    if (major(dev) == 0) return -1;
+
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%s", major(dev), minor(dev), attr);
+    if (read_sysfs_int(path, &value) == 0) return value;
+
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../%s", major(dev), minor(dev), attr);
+    if (read_sysfs_int(path, &value) == 0) return value;
+
+    return -1;
+}
+
+int device_is_rotational(unsigned long long dev) {
+    return block_attr(dev, "queue/rotational");
+}
+
+int device_numa_node(unsigned long long dev) {
+    return block_attr(dev, "device/numa_node");
+}
+
+static int pin_to_node(pthread_t thread, int node) {
+    char path[MAX_PATH];
+    char list[1024];
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    // cpulist looks like "0-7,16-23"
+    char* cursor = list;
+    while (*cursor && *cursor != '\n') {
+        char* end = NULL;
+        long first = strtol(cursor, &end, 10);
+        if (end == cursor) break;
+        long last = first;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) CPU_SET((int)cpu, &set);
+
+        cursor = (*end == ',') ? end + 1 : end;
+    }
+
+    if (CPU_COUNT(&set) == 0) return -1;
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+#else
+
+int device_is_rotational(unsigned long long dev) {
+    (void)dev;
+    return -1;
+}
+
+int device_numa_node(unsigned long long dev) {
+    (void)dev;
+    return -1;
+}
+
+#endif
+
+// Every destination gets each write, so one rotational root slows the whole pool down.
+static int destinations_rotational(const device_pools_t* pools) {
+    if (device_is_rotational(pools->dest_dev) == 1) return TRUE;
+    if (!pools->dests) return FALSE;
+
+    for (int k = 1; k < pools->dests->count; ++k) {
+        struct stat st;
+        if (stat(pools->dests->roots[k], &st) == 0 && device_is_rotational((unsigned long long)st.st_dev) == 1) return TRUE;
+    }
+    return FALSE;
+}
+
+static device_pool_t* start_pool(device_pools_t* pools, unsigned long long src_dev) {
+    device_pool_t* pool = &pools->pools[pools->count];
+    memset(pool, 0, sizeof(*pool));
+
+    pool->src_dev = src_dev;
+    pool->dest_dev = pools->dest_dev;
+    pool->rotational = device_is_rotational(src_dev) == 1 || destinations_rotational(pools);
+    pool->numa_node = device_numa_node(src_dev);
+
+    // Seek order only matters for the disk being read.
+    if (pools->physical_order == PHYSICAL_ORDER_ON || (pools->physical_order == PHYSICAL_ORDER_AUTO && device_is_rotational(src_dev) == 1)) {
+        pool->window = malloc(PHYSICAL_ORDER_WINDOW * sizeof(ordered_task_t));
+        pool->spare = malloc(PHYSICAL_ORDER_WINDOW * sizeof(ordered_task_t));
+        pool->ordered = pool->window && pool->spare;
+        if (!pool->ordered) fprintf(stderr, YEL "Cannot allocate the reorder window, device pool #%d keeps scan order\n" RESET, pools->count);
+    }
+
+    int num_workers = MAX(pools->workers_per_pool, 1);
+    if (pools->per_device && pool->rotational) num_workers = MIN(num_workers, MAX(pools->hdd_workers, 1));
+
+    if (pools->high_watermark) {
+        printf(PRP "Creating a task queue, with %zu capacity and %zu/%zu bytes watermarks...\n" RESET, pools->queue_capacity, pools->high_watermark, pools->low_watermark);
+        pool->queue = queue_create_budgeted(pools->queue_capacity, pools->high_watermark, pools->low_watermark);
+        if (pool->queue) pool->queue->pop_bytes = MAX(pools->high_watermark / num_workers, MAX_BUFFER);
+    } else {
+        printf(PRP "Creating a task queue, with %zu capacity...\n" RESET, pools->queue_capacity);
+        pool->queue = queue_create(pools->queue_capacity);
+    }
+    if (!pool->queue) {
+        fprintf(stderr, RED "Critical error: Cannot create task queue\n" RESET);
+        return NULL;
+    }
+
+    pool->workers = calloc(num_workers, sizeof(pthread_t));
+    pool->contexts = calloc(num_workers, sizeof(thread_context_t));
+    if (!pool->workers || !pool->contexts) {
+        fprintf(stderr, RED "Critical error: Cannot allocate workers for device pool #%d\n" RESET, pools->count);
+        free(pool->window);
+        free(pool->spare);
+        free(pool->workers);
+        free(pool->contexts);
+        queue_destroy(pool->queue);
+        return NULL;
+    }
+
+    printf(
+        PRP "Creating %d workers and contexts for device pool #%d%s%s...\n" RESET,
+        num_workers, pools->count, pool->rotational ? " (rotational)" : "", pool->ordered ? " (physical order)" : ""
+    );
+    for (int i = 0; i < num_workers; ++i) {
+        thread_context_t* context = &pool->contexts[i];
+        context->id = pools->next_worker_id++;
+        context->queue = pool->queue;
+        context->links = pools->links;
+        context->plan = pools->plan;
+        context->dests = pools->dests;
+        context->move = pools->move;
+        context->syncer = pools->syncer;
+        context->pack = pools->pack;
+        context->verify = pools->verify;
+        context->stats = calloc(1, sizeof(worker_stats_t));
+
+        if (!context->stats || pthread_create(&pool->workers[i], NULL, pools->worker, context) != 0) {
+            fprintf(stderr, RED "Cannot create worker #%d\n" RESET, context->id);
+            free(context->stats);
+            break;
+        }
+        ++pool->num_workers;
+
+#ifdef __linux__
+        if (pools->pin && pool->numa_node >= 0 && pin_to_node(pool->workers[i], pool->numa_node) != 0) {
+            fprintf(stderr, YEL "Cannot pin worker #%d to NUMA node %d\n" RESET, context->id, pool->numa_node);
+        }
+#endif
+        printf(GRN "Worker #%d created succesfully\n" RESET, context->id);
+    }
+
+    if (pool->num_workers == 0) {
+        free(pool->window);
+        free(pool->spare);
+        free(pool->workers);
+        free(pool->contexts);
+        queue_destroy(pool->queue);
+        return NULL;
+    }
+
+    if (pools->prefetch_budget) {
+        queue_set_prefetch(pool->queue, pools->prefetch_budget, PREFETCH_FILE_BYTES);
+
+        if (pthread_create(&pool->prefetcher, NULL, prefetch_thread, pool->queue) == 0) {
+            pool->prefetching = TRUE;
+            printf(GRN "Prefetcher for device pool #%d created succesfully, %zu bytes look-ahead\n" RESET, pools->count, pools->prefetch_budget);
+        } else {
+            fprintf(stderr, YEL "Cannot create prefetcher for device pool #%d, copying without readahead\n" RESET, pools->count);
+            queue_set_prefetch(pool->queue, 0, 0);
+        }
+    }
+
+    ++pools->count;
+    return pool;
+}
+
+// Expects pools->mutex to be held.
+static device_pool_t* pool_for(device_pools_t* pools, unsigned long long src_dev) {
+    device_pool_t* pool = NULL;
+    if (!pools->per_device) {
+        pool = pools->count > 0 ? &pools->pools[0] : start_pool(pools, src_dev);
+    } else {
+        for (int p = 0; p < pools->count && !pool; ++p) {
+            if (pools->pools[p].src_dev == src_dev) pool = &pools->pools[p];
+        }
+        if (!pool) {
+            // Past the pool limit, extra devices share the first pool rather than failing the copy.
+            pool = pools->count < MAX_DEVICE_POOLS ? start_pool(pools, src_dev) : &pools->pools[0];
+        }
+    }
+
+    return pool;
+}
+
+task_queue_t* device_pools_route(device_pools_t* pools, unsigned long long src_dev) {
+    pthread_mutex_lock(&pools->mutex);
+    device_pool_t* pool = pool_for(pools, src_dev);
+    pthread_mutex_unlock(&pools->mutex);
+
+    return pool ? pool->queue : NULL;
+}
+
+static void enqueue_window(device_pool_t* pool, ordered_task_t* window, size_t count) {
+    copy_task_t batch[BATCH_SIZE];
+
+    for (size_t i = 0; i < count; ) {
+        int batch_count = 0;
+        while (batch_count < BATCH_SIZE && i < count) batch[batch_count++] = window[i++].task;
+
+        queue_enqueue_batch(pool->queue, batch, batch_count);
+    }
+}
+
+// Expects pools->mutex to be held, and returns with it held. Enqueues the window in physical order, BATCH_SIZE tasks at a time.
+// The full window is swapped for the spare and enqueued with the mutex released, so a producer blocked on a full queue does
+// not stall the others. Only one drain per pool is in flight, so windows reach the queue in the order they filled up.
+static void drain_window(device_pools_t* pools, device_pool_t* pool) {
+    while (!pool->spare) pthread_cond_wait(&pools->drained, &pools->mutex);
+    if (pool->window_count == 0) return;
+
+    ordered_task_t* window = pool->window;
+    size_t count = pool->window_count;
+
+    pool->window = pool->spare;
+    pool->spare = NULL;
+    pool->window_count = 0;
+    pthread_cond_broadcast(&pools->drained);
+    pthread_mutex_unlock(&pools->mutex);
+
+    sort_window(window, count);
+    enqueue_window(pool, window, count);
+
+    pthread_mutex_lock(&pools->mutex);
+    pool->spare = window;
+    pthread_cond_broadcast(&pools->drained);
+}
+
+int device_pools_submit(device_pools_t* pools, unsigned long long src_dev, copy_task_t* tasks, int count) {
+    pthread_mutex_lock(&pools->mutex);
+    device_pool_t* pool = pool_for(pools, src_dev);
+    pthread_mutex_unlock(&pools->mutex);
+
+    if (!pool) return -1;
+    if (!pool->ordered) {
+        queue_enqueue_batch(pool->queue, tasks, count);
+        return 0;
+    }
+
+    // The keys cost an open and an ioctl per file, so they are computed before taking the lock.
+    unsigned long long keys[BATCH_SIZE];
+    for (int i = 0; i < count; ++i) keys[i] = physical_key(&tasks[i], &pool->fiemap_state);
+
+    pthread_mutex_lock(&pools->mutex);
+    for (int i = 0; i < count; ++i) {
+        // Another producer may have refilled the window while this one waited for the spare.
+        while (pool->window_count == PHYSICAL_ORDER_WINDOW) drain_window(pools, pool);
+
+        ordered_task_t* slot = &pool->window[pool->window_count++];
+        slot->key = keys[i];
+        slot->seq = pool->window_seq++;
+        slot->task = tasks[i];
+
+        if (pool->window_count == PHYSICAL_ORDER_WINDOW) drain_window(pools, pool);
+    }
+    pthread_mutex_unlock(&pools->mutex);
+
+    return 0;
+}
+
+void device_pools_flush(device_pools_t* pools) {
+    pthread_mutex_lock(&pools->mutex);
+    for (int p = 0; p < pools->count; ++p) {
+        if (pools->pools[p].window_count) drain_window(pools, &pools->pools[p]);
+    }
+    pthread_mutex_unlock(&pools->mutex);
+}
+
+void device_pools_shutdown(device_pools_t* pools) {
+    pthread_mutex_lock(&pools->mutex);
+
+    for (int p = 0; p < pools->count; ++p) {
+        device_pool_t* pool = &pools->pools[p];
+
+        if (pool->window_count) drain_window(pools, pool);
+        // A window another producer is still enqueueing must land before the workers are told to stop.
+        if (pool->ordered) {
+            while (!pool->spare) pthread_cond_wait(&pools->drained, &pools->mutex);
+        }
+    }
+
+    for (int p = 0; p < pools->count; ++p) {
+        task_queue_t* queue = pools->pools[p].queue;
+
+        pthread_mutex_lock(&queue->mutex);
+        queue->shutdown = -1;
+        pthread_cond_broadcast(&queue->not_empty);
+        pthread_cond_broadcast(&queue->prefetch_wake);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    pthread_mutex_unlock(&pools->mutex);
+}
+
+void device_pools_join(device_pools_t* pools) {
+    for (int p = 0; p < pools->count; ++p) {
+        for (int i = 0; i < pools->pools[p].num_workers; ++i) {
+            pthread_join(pools->pools[p].workers[i], NULL);
+        }
+        if (pools->pools[p].prefetching) pthread_join(pools->pools[p].prefetcher, NULL);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,91 @@
+#ifndef DEVICE_POOLS_H
+#define DEVICE_POOLS_H
+
+#include "core.h"
+#include "physicalOrder.h"
+
+#define MAX_DEVICE_POOLS 16
+#define DEFAULT_HDD_WORKERS 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct device_pool_t {
+    unsigned long long src_dev;
+    unsigned long long dest_dev;
+    int rotational;
+    int numa_node;
+
+    task_queue_t* queue;
+    int num_workers;
+    pthread_t* workers;
+    thread_context_t* contexts;
+
+    pthread_t prefetcher;
+    int prefetching;
+
+    // Physical-order reorder window, only allocated when the pool sorts its tasks.
+    int ordered;
+    int fiemap_state;
+    ordered_task_t* window;
+    size_t window_count;
+    size_t window_seq;
+    // Swapped in while a full window is enqueued outside the pools mutex. NULL while that drain is in flight.
+    ordered_task_t* spare;
+} device_pool_t;
+
+// Routes tasks to one queue + worker pool per source device, so a slow disk gets its own concurrency
+// limit instead of sharing workers with a fast one. A pool counts as rotational when its source or
+// any destination (the primary or a --mirror root) is.
+typedef struct device_pools_t {
+    device_pool_t pools[MAX_DEVICE_POOLS];
+    int count;
+    int next_worker_id;
+    pthread_mutex_t mutex;
+    pthread_cond_t drained;
+
+    int per_device;
+    int pin;
+    int workers_per_pool;
+    int hdd_workers;
+    unsigned long long dest_dev;
+
+    size_t queue_capacity;
+    size_t high_watermark;
+    size_t low_watermark;
+    size_t prefetch_budget;
+    int physical_order;
+
+    inode_map_t* links;
+    plan_t* plan;
+    const destination_set_t* dests;
+    int move;
+    syncer_t* syncer;
+    pack_t* pack;
+    verify_t* verify;
+    void* (*worker)(void*);
+} device_pools_t;
+
+int device_pools_init(device_pools_t* pools);
+int device_pools_destroy(device_pools_t* pools);
+
+// Returns the queue serving src_dev, starting its pool on first use. NULL if the pool cannot be created.
+task_queue_t* device_pools_route(device_pools_t* pools, unsigned long long src_dev);
+// Hands a batch of at most BATCH_SIZE tasks to the pool serving src_dev. Ordered pools hold tasks back in their window until it
+// fills up or device_pools_flush() is called. Returns -1 (the tasks untouched) if there is no pool.
+int device_pools_submit(device_pools_t* pools, unsigned long long src_dev, copy_task_t* tasks, int count);
+void device_pools_flush(device_pools_t* pools);
+
+void device_pools_shutdown(device_pools_t* pools);
+void device_pools_join(device_pools_t* pools);
+
+// Linux sysfs lookups; both return -1 when the device is unknown or not block-backed.
+int device_is_rotational(unsigned long long dev);
+int device_numa_node(unsigned long long dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include "dirCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+void dir_cache_init(dir_cache_t* cache) {
+    memset(cache, 0, sizeof(*cache));
+    for (int i = 0; i < DIR_CACHE_SIZE; ++i) cache->entries[i].fd = -1;
+}
+
+void dir_cache_close(dir_cache_t* cache) {
+    for (int i = 0; i < DIR_CACHE_SIZE; ++i) {
+#ifndef _WIN32
+        if (cache->entries[i].fd != -1) close(cache->entries[i].fd);
+#endif
+        free(cache->entries[i].path);
+        cache->entries[i].path = NULL;
+        cache->entries[i].fd = -1;
+    }
+}
+
+#ifdef _WIN32
+
+int dir_cache_resolve(dir_cache_t* cache, const char* path, const char** leaf) {
+    (void)cache; (void)path; (void)leaf;
+    errno = ENOSYS;
+    return -1;
+}
+
+#else //POSIX
+
+static int cache_lookup(dir_cache_t* cache, const char* dir, size_t len) {
+    for (int i = 0; i < DIR_CACHE_SIZE; ++i) {
+        dir_cache_entry_t* entry = &cache->entries[i];
+        if (entry->fd != -1 && entry->path_len == len && memcmp(entry->path, dir, len) == 0) {
+            entry->last_used = ++cache->clock;
+            ++cache->hits;
+            return entry->fd;
+        }
+    }
+    return -1;
+}
+
+static void cache_insert(dir_cache_t* cache, char* dir, size_t len, int fd) {
+    dir_cache_entry_t* victim = &cache->entries[0];
+    for (int i = 0; i < DIR_CACHE_SIZE; ++i) {
+        if (cache->entries[i].fd == -1) {
+            victim = &cache->entries[i];
+            break;
+        }
+        if (cache->entries[i].last_used < victim->last_used) victim = &cache->entries[i];
+    }
+
+    if (victim->fd != -1) close(victim->fd);
+    free(victim->path);
+
+    victim->path = dir;
+    victim->path_len = len;
+    victim->fd = fd;
+    victim->last_used = ++cache->clock;
+}
+
+static int open_dir(dir_cache_t* cache, const char* dir, size_t len) {
+    int fd = cache_lookup(cache, dir, len);
+    if (fd != -1) return fd;
+    ++cache->misses;
+
+    char* copy = malloc(len + 1);
+    if (!copy) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(copy, dir, len);
+    copy[len] = '\0';
+
+    fd = open(copy, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT) {
+        // Workers may reach a file before the mkdir task for its directory, so create parents on demand.
+        const char* name = NULL;
+        int parent_fd = dir_cache_resolve(cache, copy, &name);
+        if (parent_fd != -1) {
+            if (mkdirat(parent_fd, name, 0755) == 0 || errno == EEXIST) {
+                fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            }
+        }
+    }
+
+    if (fd == -1) {
+        int saved = errno;
+        free(copy);
+        errno = saved;
+        return -1;
+    }
+
+    cache_insert(cache, copy, len, fd);
+    return fd;
+}
+
+int dir_cache_resolve(dir_cache_t* cache, const char* path, const char** leaf) {
+    const char* slash = strrchr(path, '/');
+    if (!slash) {
+        *leaf = path;
+        return AT_FDCWD;
+    }
+
+    *leaf = slash + 1;
+    if (slash == path) return open_dir(cache, "/", 1);
+
+    return open_dir(cache, path, (size_t)(slash - path));
+}
+
+#endif
\ No newline at end of file
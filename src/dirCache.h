@@ -0,0 +1,39 @@
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+#include "core.h"
+
+#define DIR_CACHE_SIZE 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dir_cache_entry_t {
+    char* path;
+    size_t path_len;
+    int fd;
+    unsigned long long last_used;
+} dir_cache_entry_t;
+
+// Per-worker LRU of open destination directory fds, so files are created with *at() calls
+// relative to their parent instead of resolving the full path every time.
+typedef struct dir_cache_t {
+    dir_cache_entry_t entries[DIR_CACHE_SIZE];
+    unsigned long long clock;
+    size_t hits;
+    size_t misses;
+} dir_cache_t;
+
+void dir_cache_init(dir_cache_t* cache);
+void dir_cache_close(dir_cache_t* cache);
+
+// Returns an fd for the parent directory of path (creating missing parents) and points *leaf
+// at the last path component. Returns -1 with errno set on failure; the fd stays owned by the cache.
+int dir_cache_resolve(dir_cache_t* cache, const char* path, const char** leaf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "inodeMap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static size_t inode_hash(unsigned long long dev, unsigned long long ino) {
+    unsigned long long h = ino ^ (dev * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+inode_map_t* inode_map_create(size_t bucket_count) {
+    inode_map_t* map = malloc(sizeof(inode_map_t));
+    if (!map) {
+        fprintf(stderr, RED "Cannot allocate memory for inode_map_t structure\n" RESET);
+        return NULL;
+    }
+
+    map->buckets = calloc(bucket_count, sizeof(inode_entry_t*));
+    if (!map->buckets) {
+        fprintf(stderr, RED "Cannot allocate memory for the buckets in inode_map_t\n" RESET);
+
+        free(map);
+
+        return NULL;
+    }
+    map->bucket_count = bucket_count;
+
+    for (int i = 0; i < INODE_MAP_STRIPES; ++i) {
+        if (pthread_mutex_init(&map->locks[i], NULL) != 0 || pthread_cond_init(&map->settled[i], NULL) != 0) {
+            fprintf(stderr, RED "Cannot initialise stripe #%d in inode_map_t\n" RESET, i);
+
+            free(map->buckets);
+            free(map);
+
+            return NULL;
+        }
+    }
+
+    return map;
+}
+
+int inode_map_destroy(inode_map_t* map) {
+    if (!map) return 0;
+
+    for (size_t i = 0; i < map->bucket_count; ++i) {
+        inode_entry_t* entry = map->buckets[i];
+        while (entry) {
+            inode_entry_t* next = entry->next;
+            free(entry->dest_path);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(map->buckets);
+
+    for (int i = 0; i < INODE_MAP_STRIPES; ++i) {
+        pthread_cond_destroy(&map->settled[i]);
+        pthread_mutex_destroy(&map->locks[i]);
+    }
+
+    free(map);
+    return 0;
+}
+
+inode_entry_t* inode_map_claim(inode_map_t* map, unsigned long long dev, unsigned long long ino, const char* dest_path, int* is_new) {
+    size_t bucket = inode_hash(dev, ino) % map->bucket_count;
+    size_t stripe = bucket % INODE_MAP_STRIPES;
+
+    *is_new = FALSE;
+    pthread_mutex_lock(&map->locks[stripe]);
+
+    inode_entry_t* entry = map->buckets[bucket];
+    while (entry && (entry->dev != dev || entry->ino != ino)) entry = entry->next;
+
+    if (!entry) {
+        entry = malloc(sizeof(inode_entry_t));
+        char* path = strdup(dest_path);
+        if (!entry || !path) {
+            free(entry);
+            free(path);
+            pthread_mutex_unlock(&map->locks[stripe]);
+            return NULL;
+        }
+
+        entry->dev = dev;
+        entry->ino = ino;
+        entry->dest_path = path;
+        entry->state = INODE_PENDING;
+        entry->next = map->buckets[bucket];
+        map->buckets[bucket] = entry;
+        *is_new = TRUE;
+    }
+
+    pthread_mutex_unlock(&map->locks[stripe]);
+    return entry;
+}
+
+void inode_map_settle(inode_map_t* map, inode_entry_t* entry, int state) {
+    size_t stripe = (inode_hash(entry->dev, entry->ino) % map->bucket_count) % INODE_MAP_STRIPES;
+
+    pthread_mutex_lock(&map->locks[stripe]);
+    entry->state = state;
+    pthread_cond_broadcast(&map->settled[stripe]);
+    pthread_mutex_unlock(&map->locks[stripe]);
+}
+
+int inode_map_wait(inode_map_t* map, inode_entry_t* entry) {
+    size_t stripe = (inode_hash(entry->dev, entry->ino) % map->bucket_count) % INODE_MAP_STRIPES;
+
+    pthread_mutex_lock(&map->locks[stripe]);
+    while (entry->state == INODE_PENDING) {
+        pthread_cond_wait(&map->settled[stripe], &map->locks[stripe]);
+    }
+    int state = entry->state;
+    pthread_mutex_unlock(&map->locks[stripe]);
+
+    return state;
+}
\ No newline at end of file
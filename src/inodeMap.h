@@ -0,0 +1,44 @@
+#ifndef INODE_MAP_H
+#define INODE_MAP_H
+
+#include "core.h"
+
+#define INODE_MAP_BUCKETS ((size_t)1 << 16)
+#define INODE_MAP_STRIPES 64
+
+#define INODE_PENDING 0
+#define INODE_DONE    1
+#define INODE_FAILED  2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct inode_entry_t {
+    unsigned long long dev;
+    unsigned long long ino;
+    char* dest_path;
+    int state;
+    struct inode_entry_t* next;
+} inode_entry_t;
+
+typedef struct inode_map_t {
+    inode_entry_t** buckets;
+    size_t bucket_count;
+    pthread_mutex_t locks[INODE_MAP_STRIPES];
+    pthread_cond_t settled[INODE_MAP_STRIPES];
+} inode_map_t;
+
+inode_map_t* inode_map_create(size_t bucket_count);
+int inode_map_destroy(inode_map_t* map);
+
+// Returns the entry for (dev, ino); *is_new is TRUE when the caller inserted it and owns the copy.
+inode_entry_t* inode_map_claim(inode_map_t* map, unsigned long long dev, unsigned long long ino, const char* dest_path, int* is_new);
+void inode_map_settle(inode_map_t* map, inode_entry_t* entry, int state);
+int inode_map_wait(inode_map_t* map, inode_entry_t* entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -1,11 +1,24 @@
 #include "core.h"
 #include "taskQueue.h"
+#include "inodeMap.h"
+#include "options.h"
+#include "devicePools.h"
+#include "plan.h"
+#include "move.h"
+#include "trace.h"
+#include "syncer.h"
+#include "watch.h"
+#include "pack.h"
+#include "copyStrategy.h"
+#include "throttle.h"
+#include "verify.h"
 
 #include <stdio.h>
 #include <string.h> 
 #include <errno.h> 
 #include <time.h>
 #include <pthread.h>
+#include <signal.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -18,32 +31,7 @@
 #include <ctype.h>
 #endif
 
-int main(int argc, char *argv[]) {
-    if (argc != 4){
-        printf(BOLD RED "Usage: " RESET CYN "<source_dir> <destination_dir> <extension_filter> " WEAK "(\"all\" - for all types)\n" RESET);
-        return 1;                                                           
-    }                                                                       
-
-    const char* source_dir = argv[1];
-    const char* destination_dir = argv[2];
-    const char* filter = argv[3];
-    
-    int num_threads;
-#ifdef _WIN32
-    SYSTEM_INFO sysInfo;
-    GetSystemInfo(&sysInfo);
-    num_threads = sysInfo.dwNumberOfProcessors; 
-#else //POSIX
-    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
-    if (nproc < 1) {
-        perror("sysconf");
-        return 1;
-    }
-
-    num_threads = nproc;
-#endif
-    printf(BLU "CPU Threads: Using %d worker threads\n" RESET, num_threads);
-    
+static int create_destination(const char* destination_dir) {
 #ifdef _WIN32
     printf(PRP "Attempting to create directory \"%s\" using WinAPI...\n" RESET, destination_dir);
     if (CreateDirectoryA(destination_dir, NULL) == 0) { 
@@ -52,7 +40,7 @@ int main(int argc, char *argv[]) {
             printf(BLU "Directory '%s' already exists.\n" RESET, destination_dir);
         } else {
             fprintf(stderr, RED "Error creating directory \"%s\": %lu\n" RESET, destination_dir, error);
-            return 1; 
+            return -1; 
         }
     } else {
         printf(GRN "Directory \"%s\" created with WinAPI successfully.\n" RESET, destination_dir);
@@ -64,37 +52,196 @@ int main(int argc, char *argv[]) {
             printf(BLU "Directory '%s' already exists.\n" RESET, destination_dir);
         } else {
             perror("mkdir");
-            return 1;
+            return -1;
         }
     } else {
         printf(GRN "Directory \"%s\" created with POSIX mkdir successfully.\n" RESET, destination_dir);
     }
 #endif
-    int num_workers = num_threads;
+    return 0;
+}
+
+static void on_stop_signal(int sig) {
+    (void)sig;
+    watch_request_stop();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "verify") == 0) return verify_main(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "unpack") == 0) {
+        if (argc != 4) {
+            print_usage();
+            return 1;
+        }
+        return pack_unpack(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "lookup") == 0) {
+        if (argc < 4) {
+            print_usage();
+            return 1;
+        }
+        return pack_print_lookup(argv[2], argv + 3, argc - 3) == 0 ? 0 : 1;
+    }
+
+    copy_options_t opts;
+    if (parse_options(argc, argv, &opts) != 0) {
+        print_usage();
+        return 1;
+    }
+
+    const char* source_dir = opts.source_dir;
+    const char* destination_dir = opts.destination_dir;
+    const char* filter = opts.filter;
+    
+    int num_threads;
+#ifdef _WIN32
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    num_threads = sysInfo.dwNumberOfProcessors; 
+#else //POSIX
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nproc < 1) {
+        perror("sysconf");
+        return 1;
+    }
+
+    num_threads = nproc;
+#endif
+    printf(BLU "CPU Threads: Using %d worker threads\n" RESET, num_threads);
+    
+    destination_set_t dests = {0};
+    dests.roots[dests.count++] = destination_dir;
+    dests.primary_len = strlen(destination_dir);
+    for (int i = 0; i < opts.mirror_count; ++i) dests.roots[dests.count++] = opts.mirrors[i];
+
+    // Rename fast paths only apply to a plain single-destination move of the whole tree.
+    int rename_move = opts.move && !opts.plan_path && !opts.list_path && dests.count == 1;
+    if (rename_move && strcmp(filter, "all") == 0 && move_root(source_dir, destination_dir)) {
+        printf(GRN "Moved \"%s\" to \"%s\" with a single rename.\n" RESET, source_dir, destination_dir);
+        return 0;
+    }
+
+    for (int i = 0; i < dests.count && !opts.plan_path; ++i) {
+        if (create_destination(dests.roots[i]) != 0) return 1;
+    }
+
+    size_t total_renamed = 0;
+    if (rename_move && same_device(source_dir, destination_dir)) {
+        printf(PRP "Same filesystem: renaming entries of \"%s\" into place...\n" RESET, source_dir);
+        int err = move_tree(source_dir, destination_dir, filter, &total_renamed);
+        if (err != 0) fprintf(stderr, RED "move_tree terminated with code %d, copying the rest\n" RESET, err);
+    }
+
+    int num_workers = opts.device_workers ? opts.device_workers : num_threads;
     int num_producers = 1;
-    int queue_capacity = BATCH_SIZE * num_threads;
+    size_t queue_capacity = BATCH_SIZE * num_workers;
+    if (opts.queue_tasks) queue_capacity = opts.queue_tasks;
+    else if (opts.queue_bytes) queue_capacity = DEFAULT_BUDGETED_TASKS;
 
     size_t total_files_checked = 0;
 
-    printf(PRP "Creating a task queue, with %d capacity...\n" RESET, queue_capacity);
-    task_queue_t* queue = queue_create(queue_capacity);
-    if(!queue) {
-        fprintf(stderr, RED "Critical error: Cannot create task queue\n" RESET);
+    inode_map_t* links = inode_map_create(INODE_MAP_BUCKETS);
+    if (!links) {
+        fprintf(stderr, RED "Critical error: Cannot create inode map\n" RESET);
         return 1;
-    } else {
+    }
+
+    device_pools_t pools;
+    if (device_pools_init(&pools) != 0) {
+        fprintf(stderr, RED "Critical error: Cannot create device pools\n" RESET);
+        return 1;
+    }
+    pools.per_device = opts.per_device;
+    pools.pin = opts.pin;
+    pools.workers_per_pool = num_workers;
+    if (opts.hdd_workers) pools.hdd_workers = opts.hdd_workers;
+    pools.queue_capacity = queue_capacity;
+    pools.high_watermark = opts.queue_bytes;
+    pools.low_watermark = opts.queue_low_bytes ? opts.queue_low_bytes : opts.queue_bytes / 2;
+    pools.links = links;
+    pools.dests = &dests;
+    pools.move = opts.move && !opts.plan_path;
+#ifdef _WIN32
+    if (opts.prefetch_bytes) fprintf(stderr, YEL "--prefetch is not supported on Windows, ignoring it\n" RESET);
+#else
+    if (!opts.plan_path) pools.prefetch_budget = opts.prefetch_bytes;
+#endif
+    pools.physical_order = opts.plan_path ? PHYSICAL_ORDER_OFF : opts.physical_order;
+#ifdef _WIN32
+    if (opts.copy_strategy != STRATEGY_AUTO && opts.copy_strategy != STRATEGY_BUFFERED) fprintf(stderr, YEL "--copy-strategy is not supported on Windows, ignoring it\n" RESET);
+#else
+    copy_strategy_mode = opts.copy_strategy;
+#endif
+
+    pack_t pack;
+    if (opts.pack_threshold) {
+        if (pack_init(&pack, destination_dir, opts.pack_threshold) != 0) return 1;
+        pools.pack = &pack;
+    }
+
+    // Planning only reads metadata, the limits are for copies sharing a host with production load.
+    int throttled = !opts.plan_path && (opts.read_limit || opts.write_limit || opts.open_limit || opts.slow_start);
+    if (throttled && throttle_start((double)opts.read_limit, (double)opts.write_limit, (double)opts.open_limit, opts.slow_start) != 0) return 1;
+
+    if (opts.trace_path) trace_start();
+
+    // Planning writes nothing to the destination, so there is nothing to make durable.
+    syncer_t syncer;
+    if (syncer_start(&syncer, opts.plan_path ? SYNC_NONE : opts.sync, &dests, opts.sync_batch ? opts.sync_batch : DEFAULT_SYNC_BATCH) != 0) return 1;
+    if (sync_mode == SYNC_GROUP) pools.syncer = &syncer;
+
+    plan_t plan;
+    if (opts.plan_path) {
+        if (plan_init(&plan, opts.plan_path, source_dir, num_workers) != 0) return 1;
+
+        // Planning never copies: one planner drains the queue in place of the workers.
+        pools.per_device = FALSE;
+        pools.workers_per_pool = 1;
+        pools.worker = planner_thread;
+        pools.plan = &plan;
+    }
+#ifndef _WIN32
+    struct stat dest_stat;
+    if (stat(destination_dir, &dest_stat) == 0) pools.dest_dev = (unsigned long long)dest_stat.st_dev;
+#endif
+    unsigned long long source_dev = 0;
+#ifndef _WIN32
+    struct stat source_stat;
+    if (stat(source_dir, &source_stat) == 0) source_dev = (unsigned long long)source_stat.st_dev;
+#endif
+
+    if (!pools.per_device) {
+        // A single shared pool is started up front, per-device pools appear as the scanner meets new devices.
+        if (!device_pools_route(&pools, source_dev)) {
+            fprintf(stderr, RED "Critical error: Cannot create worker pool\n" RESET);
+            return 1;
+        }
         printf(GRN "Queue created succesfully\n" RESET);
     }
 
+    // Watches go in before the initial scan so that changes made while it runs are replicated too.
+    watch_t watch;
+    if (opts.watch) {
+        if (watch_init(&watch, source_dir, destination_dir, filter, opts.debounce_ms) != 0) return 1;
+
+        signal(SIGINT, on_stop_signal);
+        signal(SIGTERM, on_stop_signal);
+    }
+
     printf(PRP "Creating %d producers and contexts...\n" RESET, num_producers);
     producer_context_t producer_contexts[num_producers];
     pthread_t producers[num_producers];
     for (int i = 0; i < num_producers; ++i) {
         producer_contexts[i].id = i;
         producer_contexts[i].filter = filter;
+        producer_contexts[i].list_path = opts.list_path;
+        producer_contexts[i].null_separated = opts.null_separated;
         producer_contexts[i].dest_dir = destination_dir;
         producer_contexts[i].src_dir = source_dir;
-        producer_contexts[i].queue = queue;
+        producer_contexts[i].pools = &pools;
+        producer_contexts[i].links = links;
         producer_contexts[i].files_counter = &total_files_checked;
+        producer_contexts[i].watch = opts.watch ? &watch : NULL;
 
         if (pthread_create(&producers[i], NULL, producer_thread, &producer_contexts[i]) != 0) {
             fprintf(stderr, RED "Cannot create producer #%d\n" RESET, i);
@@ -102,39 +249,69 @@ int main(int argc, char *argv[]) {
         } else {
             printf(GRN "Producer #%d created succesfully\n" RESET, i);
         }
-        pthread_detach(producers[i]);
-    }
-    
-    printf(PRP "Creating %d workers and contexts...\n" RESET, num_workers);
-    pthread_t workers[num_workers];
-    thread_context_t contexts[num_workers];
-
-    for (int i = 0; i < num_workers; ++i) {
-        contexts[i].id = i;
-        contexts[i].queue = queue;
-        contexts[i].stats = calloc(1, sizeof(worker_stats_t));
-        
-        if (pthread_create(&workers[i], NULL, worker_thread, &contexts[i]) != 0) {
-            fprintf(stderr, RED "Cannot create worker #%d\n" RESET, i);
-            return -1;
-        } else {
-            printf(GRN "Worker #%d created succesfully\n" RESET, i);
-        }
     }
 
     printf(PRP "Starting copy\n" RESET);
     clock_t start = clock();
 
-    for (int i = 0; i < num_workers; i++) {
-        pthread_join(workers[i], NULL); 
+    for (int i = 0; i < num_producers; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    device_pools_join(&pools);
+
+    // The index goes out before the final sync so that --sync end/group cover it too.
+    if (pools.pack && pack_finish(&pack) != 0) fprintf(stderr, RED "Cannot write the pack index in \"%s\"\n" RESET, destination_dir);
+    syncer_finish(&syncer);
+
+    if (opts.watch) watch_destroy(&watch);
+
+    // A list-driven move names files, not directories; the tree around them is not ours to prune.
+    if (pools.move && !opts.list_path) prune_moved_dirs(source_dir);
+
+    if (opts.trace_path) {
+        if (trace_dump(opts.trace_path) == 0) printf(GRN "Trace written to \"%s\"\n" RESET, opts.trace_path);
+        trace_report();
+        trace_finish();
+    }
+
+    if (opts.plan_path) {
+        plan_probe(&plan, destination_dir);
+        plan_report(&plan);
+        printf(GRN "Manifest written to \"%s\"\n" RESET, opts.plan_path);
+
+        int res = plan_finish(&plan);
+        device_pools_destroy(&pools);
+        inode_map_destroy(links);
+
+        return res == 0 ? 0 : 1;
     }
 
     size_t total_bytes = 0;
     size_t total_files = 0;
-    for (int i = 0; i < num_workers; i++) {
-        total_bytes += contexts[i].stats->total_bytes;
-        total_files += contexts[i].stats->total_files;
-        free(contexts[i].stats);
+    size_t total_links = 0;
+    size_t dest_failures[MAX_DESTINATIONS] = {0};
+    double file_sync_seconds = 0;
+    for (int p = 0; p < pools.count; ++p) {
+        device_pool_t* pool = &pools.pools[p];
+        size_t pool_bytes = 0;
+        size_t pool_files = 0;
+
+        for (int i = 0; i < pool->num_workers; i++) {
+            pool_bytes += pool->contexts[i].stats->total_bytes;
+            pool_files += pool->contexts[i].stats->total_files;
+            total_links += pool->contexts[i].stats->total_links;
+            for (int k = 0; k < dests.count; ++k) dest_failures[k] += pool->contexts[i].stats->dest_failures[k];
+            file_sync_seconds += pool->contexts[i].stats->sync_seconds;
+        }
+        total_bytes += pool_bytes;
+        total_files += pool_files;
+
+        if (pools.per_device) {
+            printf(
+                WEAK "Device pool #%d (dev %llu%s, %d workers): %zu files, %zu bytes\n" RESET,
+                p, pool->src_dev, pool->rotational ? ", rotational" : "", pool->num_workers, pool_files, pool_bytes
+            );
+        }
     }
 
     clock_t end = clock();  
@@ -143,11 +320,52 @@ int main(int argc, char *argv[]) {
     printf (
         GRN "\nSearch and copy in %s completed.\n"  
         YEL "Total %s files copied: %zu\n"
+        YEL "Total links recreated: %zu\n"
         BLU "Total checked files count: %zu\n"
         CYN "Total copied files size: %zu bytes\n"
         PRP "Total time: %.2f sec\n"
-        RESET, source_dir, filter, total_files, total_files_checked, total_bytes, elapsed_time
+        RESET, source_dir, filter, total_files, total_links, total_files_checked, total_bytes, elapsed_time
     );
+
+    if (opts.move) {
+        printf(CYN "Total entries renamed in place: %zu\n" RESET, total_renamed);
+    }
+
+    strategy_report();
+    if (throttled) {
+        throttle_report();
+        throttle_finish();
+    }
+
+    if (pools.pack) {
+        printf(CYN "Packed %zu files (%zu bytes) into %d packs\n" RESET, pack.packed_files, pack.packed_bytes, pack.pack_count);
+    }
+
+    if (sync_mode != SYNC_NONE) {
+        printf(
+            CYN "Sync (%s): %.2f sec in fdatasync, %.2f sec in %zu filesystem syncs\n" RESET,
+            sync_mode_name(sync_mode), file_sync_seconds, syncer.sync_seconds, syncer.syncs
+        );
+    }
+
+    if (dests.count > 1) {
+        for (int k = 0; k < dests.count; ++k) {
+            printf("%sDestination \"%s\": %zu failures\n" RESET, dest_failures[k] ? RED : GRN, dests.roots[k], dest_failures[k]);
+        }
+    }
+
+    for (int p = 0; p < pools.count; ++p) {
+        task_queue_t* queue = pools.pools[p].queue;
+        if (queue->high_watermark) {
+            printf(WEAK "Peak queued bytes: %zu of %zu\n" RESET, queue->peak_bytes, queue->high_watermark);
+        }
+        if (pools.pools[p].prefetching) {
+            printf(WEAK "Prefetched %zu files, %zu bytes read ahead\n" RESET, queue->prefetched_files, queue->prefetched_bytes);
+        }
+    }
+
+    device_pools_destroy(&pools);
+    inode_map_destroy(links);
     
     return 0;
 }
\ No newline at end of file
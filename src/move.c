@@ -0,0 +1,188 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "move.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+
+int move_tree(const char* src, const char* dest, const char* filter, size_t* renamed) {
+    (void)src; (void)dest; (void)filter; (void)renamed;
+    return 0;
+}
+
+int move_root(const char* src, const char* dest) {
+    (void)src; (void)dest;
+    return FALSE;
+}
+
+void note_moved(const char* path) {
+    (void)path;
+}
+
+void prune_moved_dirs(const char* root) {
+    (void)root;
+}
+
+int same_device(const char* src, const char* dest) {
+    (void)src; (void)dest;
+    return FALSE;
+}
+
+#else //POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static int rename_noreplace(const char* src, const char* dest) {
+#ifdef RENAME_NOREPLACE
+    if (renameat2(AT_FDCWD, src, AT_FDCWD, dest, RENAME_NOREPLACE) == 0) return 0;
+    if (errno != EINVAL && errno != ENOSYS) return -1;
+#endif
+    // Filesystems without RENAME_NOREPLACE: check first, accepting the small race.
+    struct stat st;
+    if (lstat(dest, &st) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(src, dest);
+}
+
+int same_device(const char* src, const char* dest) {
+    struct stat src_stat, dest_stat;
+    if (lstat(src, &src_stat) != 0 || stat(dest, &dest_stat) != 0) return FALSE;
+    return src_stat.st_dev == dest_stat.st_dev;
+}
+
+// EEXIST (dest appeared meanwhile) or EXDEV leave the tree to the entry-by-entry paths.
+int move_root(const char* src, const char* dest) {
+    return rename_noreplace(src, dest) == 0;
+}
+
+int move_tree(const char* src, const char* dest, const char* filter, size_t* renamed) {
+    DIR* dir = opendir(src);
+    if (!dir) return errno;
+
+    int move_all = strcmp(filter, "all") == 0;
+    int err_code = 0;
+    char src_path[MAX_PATH];
+    char dest_path[MAX_PATH];
+    struct dirent* entry;
+
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        if (snprintf(src_path, sizeof(src_path), "%s/%s", src, entry->d_name) >= (int)sizeof(src_path)) continue;
+        if (snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, entry->d_name) >= (int)sizeof(dest_path)) continue;
+
+        struct stat st;
+        if (lstat(src_path, &st) == -1) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            // A filtered move must leave non-matching files behind, so it can only rename file by file.
+            if (move_all && rename_noreplace(src_path, dest_path) == 0) {
+                note_moved(src_path);
+                ++*renamed;
+                continue;
+            }
+            if (move_all && errno != EEXIST && errno != ENOTEMPTY) continue;
+
+            struct stat dest_stat;
+            if (!move_all && mkdir(dest_path, 0755) != 0 && errno != EEXIST) continue;
+            if (stat(dest_path, &dest_stat) != 0 || !S_ISDIR(dest_stat.st_mode)) continue;
+
+            err_code = move_tree(src_path, dest_path, filter, renamed);
+            if (err_code != 0) break;
+        } else if (check_extension(src_path, filter)) {
+            // EXDEV, EEXIST and friends leave the file for the copy pipeline.
+            if (rename_noreplace(src_path, dest_path) == 0) {
+                note_moved(src_path);
+                ++*renamed;
+            }
+        }
+    }
+
+    closedir(dir);
+    return err_code;
+}
+
+static pthread_mutex_t moved_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char** moved_dirs = NULL;
+static size_t moved_count = 0;
+static size_t moved_capacity = 0;
+
+void note_moved(const char* path) {
+    const char* slash = strrchr(path, '/');
+    if (!slash || slash == path) return;
+    size_t len = (size_t)(slash - path);
+
+    pthread_mutex_lock(&moved_mutex);
+
+    // Files of one directory tend to finish together, so most repeats are caught here already.
+    char* last = moved_count > 0 ? moved_dirs[moved_count - 1] : NULL;
+    if (!last || strlen(last) != len || memcmp(last, path, len) != 0) {
+        if (moved_count == moved_capacity) {
+            size_t capacity = MAX(moved_capacity * 2, (size_t)256);
+            char** dirs = realloc(moved_dirs, capacity * sizeof(char*));
+            if (dirs) {
+                moved_dirs = dirs;
+                moved_capacity = capacity;
+            }
+        }
+        char* dir = moved_count < moved_capacity ? malloc(len + 1) : NULL;
+        if (dir) {
+            memcpy(dir, path, len);
+            dir[len] = '\0';
+            moved_dirs[moved_count++] = dir;
+        }
+    }
+
+    pthread_mutex_unlock(&moved_mutex);
+}
+
+// Deepest first, so a directory is tried after everything below it.
+static int compare_depth(const void* a, const void* b) {
+    size_t left = strlen(*(char* const*)a);
+    size_t right = strlen(*(char* const*)b);
+    if (left != right) return left < right ? 1 : -1;
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+void prune_moved_dirs(const char* root) {
+    size_t root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') --root_len;
+
+    pthread_mutex_lock(&moved_mutex);
+    qsort(moved_dirs, moved_count, sizeof(char*), compare_depth);
+
+    for (size_t i = 0; i < moved_count; ++i) {
+        char* dir = moved_dirs[i];
+        if (i > 0 && strcmp(dir, moved_dirs[i - 1]) == 0) continue;
+
+        // Walk up while each rmdir succeeds; ENOTEMPTY means something was filtered out, failed or was never ours.
+        size_t len = strlen(dir);
+        while (len > root_len && strncmp(dir, root, root_len) == 0 && dir[root_len] == '/') {
+            if (rmdir(dir) != 0) break;
+
+            char* slash = strrchr(dir, '/');
+            if (!slash) break;
+            *slash = '\0';
+            len = (size_t)(slash - dir);
+        }
+    }
+
+    for (size_t i = 0; i < moved_count; ++i) free(moved_dirs[i]);
+    free(moved_dirs);
+    moved_dirs = NULL;
+    moved_count = 0;
+    moved_capacity = 0;
+
+    pthread_mutex_unlock(&moved_mutex);
+}
+
+#endif
\ No newline at end of file
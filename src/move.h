@@ -0,0 +1,32 @@
+#ifndef MOVE_H
+#define MOVE_H
+
+#include "core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same-filesystem fast path of --move: renames whole entries of src into dest at the highest level
+// possible and descends only where dest already has a directory of the same name. Anything that
+// cannot be renamed (other device, existing file, filtered directory contents) is left in src for
+// the copy pipeline. Returns 0 or an errno-style code; *renamed counts entries moved.
+int move_tree(const char* src, const char* dest, const char* filter, size_t* renamed);
+
+// Renames the source root itself when dest does not exist yet. Returns TRUE when the whole tree moved.
+int move_root(const char* src, const char* dest);
+
+// Records that path was moved away, so its directory may have been emptied by this run. Thread-safe.
+void note_moved(const char* path);
+
+// Removes the directories under root that this run emptied, bottom-up, and the ancestors that became
+// empty as a result. Directories that were empty to begin with, and root itself, are left alone.
+void prune_moved_dirs(const char* root);
+
+int same_device(const char* src, const char* dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
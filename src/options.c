@@ -0,0 +1,219 @@
+#include "options.h"
+#include "devicePools.h"
+#include "watch.h"
+#include "physicalOrder.h"
+#include "copyStrategy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+
+void print_usage(void) {
+    printf(BOLD RED "Usage: " RESET CYN "<source_dir> <destination_dir> <extension_filter> [options] " WEAK "(\"all\" - for all types)\n" RESET);
+    printf(
+        CYN "  --queue-bytes <size>     " WEAK "bound queued work by file size (e.g. 512M), producers block at this high watermark\n"
+        CYN "  --queue-low-bytes <size> " WEAK "low watermark producers wait for once blocked (default: half of --queue-bytes)\n"
+        CYN "  --queue-tasks <n>        " WEAK "maximum queued tasks (default: 32 per thread, %d with --queue-bytes)\n"
+        CYN "  --per-device             " WEAK "give every source device its own queue and worker pool\n"
+        CYN "  --device-workers <n>     " WEAK "workers per pool (default: one per CPU thread)\n"
+        CYN "  --hdd-workers <n>        " WEAK "worker limit for pools on rotational devices (default: %d)\n"
+        CYN "  --pin                    " WEAK "pin pool workers to the NUMA node of their source device\n"
+        CYN "  --plan <manifest>        " WEAK "scan only: write a binary manifest, size histogram and time estimate\n"
+        CYN "  --files-from <list|->    " WEAK "copy only the paths (relative to source) listed in a file or on stdin\n"
+        CYN "  --null                   " WEAK "--files-from entries are NUL-separated instead of newline-separated\n"
+        CYN "  --mirror <dir>           " WEAK "also write every file to dir, reading the source once (repeatable, up to %d)\n"
+        CYN "  --move                   " WEAK "move instead of copy: rename on the same filesystem, copy then unlink across devices\n"
+        CYN "  --trace <file.json>      " WEAK "record per-thread spans, write a Chrome trace and print latency histograms\n"
+        CYN "  --sync <mode>            " WEAK "durability: none (default), end (syncfs at the end), group (periodic syncfs), file (fdatasync each file)\n"
+        CYN "  --sync-batch <n>         " WEAK "files completed before a group sync is forced (default: %d, at least every %d ms)\n"
+        CYN "  --watch                  " WEAK "after the initial copy keep replicating changes until interrupted (Linux)\n"
+        CYN "  --debounce <ms>          " WEAK "quiet time before a burst of --watch events is replicated (default: %d)\n"
+        CYN "  --prefetch <size>        " WEAK "read ahead of the workers, keeping up to size bytes of upcoming files warm in the page cache\n"
+        CYN "  --physical-order <mode>  " WEAK "on, off or auto (default): sort tasks by on-disk position on rotational sources\n"
+        CYN "  --pack <size>            " WEAK "store files smaller than size in per-worker pack files with a sorted index\n"
+        CYN "  --copy-strategy <mode>   " WEAK "auto (default: measure and pick per size class), buffered, buffered-64k, buffered-1m, mmap, kernel or direct\n"
+        CYN "  --read-limit <size>      " WEAK "read at most size bytes per second across all workers\n"
+        CYN "  --write-limit <size>     " WEAK "write at most size bytes per second (every --mirror copy counts)\n"
+        CYN "  --open-limit <n>         " WEAK "open at most n source files per second\n"
+        CYN "  --slow-start             " WEAK "ramp the write rate up and halve it whenever destination write latency rises\n"
+        RESET, DEFAULT_BUDGETED_TASKS, DEFAULT_HDD_WORKERS, MAX_DESTINATIONS - 1, DEFAULT_SYNC_BATCH, SYNC_GROUP_INTERVAL_MS, DEFAULT_DEBOUNCE_MS
+    );
+    printf(BOLD RED "       " RESET CYN "verify <source_dir> <destination_dir> <extension_filter> [--json] [--metadata] [--output <file>]\n" RESET);
+    printf(BOLD RED "       " RESET CYN "unpack <destination_dir> <out_dir>   " WEAK "extract the files packed by --pack into out_dir\n" RESET);
+    printf(BOLD RED "       " RESET CYN "lookup <destination_dir> <path>...   " WEAK "show where packed paths live\n" RESET);
+}
+
+int parse_size(const char* s, size_t* out) {
+    if (is_empty(s)) return -1;
+
+    // strtoull() would quietly negate "-1" into a huge size.
+    while (isspace((unsigned char)*s)) ++s;
+    if (*s == '-') return -1;
+
+    char* end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(s, &end, 10);
+    if (end == s || errno == ERANGE) return -1;
+
+    unsigned long long multiplier = 1;
+    switch (tolower((unsigned char)*end)) {
+        case 'k': multiplier = KILO_BYTE; ++end; break;
+        case 'm': multiplier = MEGA_BYTE; ++end; break;
+        case 'g': multiplier = GIGA_BYTE; ++end; break;
+        default: break;
+    }
+    if (*end == 'b' || *end == 'B') ++end;
+    if (*end != '\0') return -1;
+
+    // A size that does not fit would wrap into a small budget or limit.
+    if (value > SIZE_MAX / multiplier) return -1;
+    value *= multiplier;
+
+    *out = (size_t)value;
+    return 0;
+}
+
+static const char* option_value(int argc, char* argv[], int* i) {
+    if (*i + 1 >= argc) {
+        fprintf(stderr, RED "Option \"%s\" expects a value\n" RESET, argv[*i]);
+        return NULL;
+    }
+    return argv[++*i];
+}
+
+static int option_size(int argc, char* argv[], int* i, size_t* out) {
+    const char* name = argv[*i];
+    const char* value = option_value(argc, argv, i);
+    if (!value) return -1;
+
+    if (parse_size(value, out) != 0) {
+        fprintf(stderr, RED "Option \"%s\": invalid size \"%s\"\n" RESET, name, value);
+        return -1;
+    }
+    return 0;
+}
+
+static int option_int(int argc, char* argv[], int* i, int* out) {
+    const char* name = argv[*i];
+    const char* value = option_value(argc, argv, i);
+    if (!value) return -1;
+
+    char* end = NULL;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < 1) {
+        fprintf(stderr, RED "Option \"%s\": expected a positive number, got \"%s\"\n" RESET, name, value);
+        return -1;
+    }
+
+    *out = (int)parsed;
+    return 0;
+}
+
+int parse_options(int argc, char* argv[], copy_options_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->physical_order = PHYSICAL_ORDER_AUTO;
+    opts->copy_strategy = STRATEGY_AUTO;
+
+    if (argc < 4) return -1;
+
+    opts->source_dir = argv[1];
+    opts->destination_dir = argv[2];
+    opts->filter = argv[3];
+
+    for (int i = 4; i < argc; ++i) {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "--queue-bytes") == 0) {
+            if (option_size(argc, argv, &i, &opts->queue_bytes) != 0) return -1;
+        } else if (strcmp(arg, "--queue-low-bytes") == 0) {
+            if (option_size(argc, argv, &i, &opts->queue_low_bytes) != 0) return -1;
+        } else if (strcmp(arg, "--queue-tasks") == 0) {
+            if (option_size(argc, argv, &i, &opts->queue_tasks) != 0) return -1;
+        } else if (strcmp(arg, "--per-device") == 0) {
+            opts->per_device = TRUE;
+        } else if (strcmp(arg, "--pin") == 0) {
+            opts->pin = TRUE;
+        } else if (strcmp(arg, "--device-workers") == 0) {
+            if (option_int(argc, argv, &i, &opts->device_workers) != 0) return -1;
+        } else if (strcmp(arg, "--hdd-workers") == 0) {
+            if (option_int(argc, argv, &i, &opts->hdd_workers) != 0) return -1;
+        } else if (strcmp(arg, "--plan") == 0) {
+            if (!(opts->plan_path = option_value(argc, argv, &i))) return -1;
+        } else if (strcmp(arg, "--files-from") == 0) {
+            if (!(opts->list_path = option_value(argc, argv, &i))) return -1;
+        } else if (strcmp(arg, "--null") == 0) {
+            opts->null_separated = TRUE;
+        } else if (strcmp(arg, "--mirror") == 0) {
+            if (opts->mirror_count >= MAX_DESTINATIONS - 1) {
+                fprintf(stderr, RED "At most %d --mirror destinations are supported\n" RESET, MAX_DESTINATIONS - 1);
+                return -1;
+            }
+            if (!(opts->mirrors[opts->mirror_count++] = option_value(argc, argv, &i))) return -1;
+        } else if (strcmp(arg, "--move") == 0) {
+            opts->move = TRUE;
+        } else if (strcmp(arg, "--trace") == 0) {
+            if (!(opts->trace_path = option_value(argc, argv, &i))) return -1;
+        } else if (strcmp(arg, "--sync") == 0) {
+            const char* value = option_value(argc, argv, &i);
+            if (!value) return -1;
+            if (parse_sync_mode(value, &opts->sync) != 0) {
+                fprintf(stderr, RED "Option \"--sync\": expected none, end, group or file, got \"%s\"\n" RESET, value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--sync-batch") == 0) {
+            if (option_size(argc, argv, &i, &opts->sync_batch) != 0) return -1;
+        } else if (strcmp(arg, "--watch") == 0) {
+            opts->watch = TRUE;
+        } else if (strcmp(arg, "--debounce") == 0) {
+            if (option_int(argc, argv, &i, &opts->debounce_ms) != 0) return -1;
+        } else if (strcmp(arg, "--prefetch") == 0) {
+            if (option_size(argc, argv, &i, &opts->prefetch_bytes) != 0) return -1;
+        } else if (strcmp(arg, "--physical-order") == 0) {
+            const char* value = option_value(argc, argv, &i);
+            if (!value) return -1;
+            if (parse_physical_order(value, &opts->physical_order) != 0) {
+                fprintf(stderr, RED "Option \"--physical-order\": expected on, off or auto, got \"%s\"\n" RESET, value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--copy-strategy") == 0) {
+            const char* value = option_value(argc, argv, &i);
+            if (!value) return -1;
+            if (parse_copy_strategy(value, &opts->copy_strategy) != 0) {
+                fprintf(stderr, RED "Option \"--copy-strategy\": unknown strategy \"%s\"\n" RESET, value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--read-limit") == 0) {
+            if (option_size(argc, argv, &i, &opts->read_limit) != 0) return -1;
+        } else if (strcmp(arg, "--write-limit") == 0) {
+            if (option_size(argc, argv, &i, &opts->write_limit) != 0) return -1;
+        } else if (strcmp(arg, "--open-limit") == 0) {
+            if (option_size(argc, argv, &i, &opts->open_limit) != 0) return -1;
+        } else if (strcmp(arg, "--slow-start") == 0) {
+            opts->slow_start = TRUE;
+        } else if (strcmp(arg, "--pack") == 0) {
+            if (option_size(argc, argv, &i, &opts->pack_threshold) != 0) return -1;
+        } else {
+            fprintf(stderr, RED "Unknown option \"%s\"\n" RESET, arg);
+            return -1;
+        }
+    }
+
+    if (opts->queue_low_bytes > opts->queue_bytes) {
+        fprintf(stderr, RED "--queue-low-bytes must not exceed --queue-bytes\n" RESET);
+        return -1;
+    }
+
+    if (opts->watch && (opts->plan_path || opts->list_path || opts->move)) {
+        fprintf(stderr, RED "--watch cannot be combined with --plan, --files-from or --move\n" RESET);
+        return -1;
+    }
+
+    if (opts->pack_threshold > 0 && (opts->plan_path || opts->mirror_count > 0 || opts->move || opts->watch)) {
+        fprintf(stderr, RED "--pack cannot be combined with --plan, --mirror, --move or --watch\n" RESET);
+        return -1;
+    }
+
+    return 0;
+}
\ No newline at end of file
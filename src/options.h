@@ -0,0 +1,67 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "core.h"
+#include "syncer.h"
+#include "copyStrategy.h"
+
+#define DEFAULT_BUDGETED_TASKS 8192
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct copy_options_t {
+    const char* source_dir;
+    const char* destination_dir;
+    const char* filter;
+
+    size_t queue_bytes;
+    size_t queue_low_bytes;
+    size_t queue_tasks;
+
+    int per_device;
+    int pin;
+    int device_workers;
+    int hdd_workers;
+
+    const char* plan_path;
+    const char* list_path;
+    int null_separated;
+
+    const char* mirrors[MAX_DESTINATIONS - 1];
+    int mirror_count;
+
+    int move;
+
+    const char* trace_path;
+
+    sync_mode_t sync;
+    size_t sync_batch;
+
+    int watch;
+    int debounce_ms;
+
+    size_t prefetch_bytes;
+    int physical_order;
+
+    size_t pack_threshold;
+
+    copy_strategy_t copy_strategy;
+
+    size_t read_limit;
+    size_t write_limit;
+    size_t open_limit;
+    int slow_start;
+} copy_options_t;
+
+int parse_options(int argc, char* argv[], copy_options_t* opts);
+void print_usage(void);
+
+int parse_size(const char* s, size_t* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,626 @@
+#include "pack.h"
+#include "syncer.h"
+#include "throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+
+int pack_init(pack_t* pack, const char* dest_root, size_t threshold) {
+    (void)dest_root; (void)threshold;
+    memset(pack, 0, sizeof(*pack));
+    fprintf(stderr, RED "--pack is not supported on Windows\n" RESET);
+    return -1;
+}
+
+int pack_file(pack_t* pack, pack_writer_t** writer, int worker_id, const char* src, const char* dest, worker_stats_t* thread_stat) {
+    (void)pack; (void)writer; (void)worker_id; (void)src; (void)dest; (void)thread_stat;
+    return ERROR_NOT_SUPPORTED;
+}
+
+int pack_finish(pack_t* pack) {
+    (void)pack;
+    return 0;
+}
+
+int pack_index_open(pack_index_t* index, const char* dest_root) {
+    (void)dest_root;
+    memset(index, 0, sizeof(*index));
+    fprintf(stderr, RED "Pack indexes are not supported on Windows\n" RESET);
+    return -1;
+}
+
+void pack_index_close(pack_index_t* index) {
+    (void)index;
+}
+
+void pack_index_entry(const pack_index_t* index, size_t i, pack_entry_t* entry) {
+    (void)index; (void)i;
+    memset(entry, 0, sizeof(*entry));
+}
+
+int pack_lookup(const pack_index_t* index, const char* path, pack_entry_t* entry) {
+    (void)index; (void)path; (void)entry;
+    return ERROR_NOT_SUPPORTED;
+}
+
+int pack_unpack(const char* dest_root, const char* out_dir) {
+    (void)dest_root; (void)out_dir;
+    fprintf(stderr, RED "unpack is not supported on Windows\n" RESET);
+    return -1;
+}
+
+int pack_print_lookup(const char* dest_root, char* const* paths, int count) {
+    (void)dest_root; (void)paths; (void)count;
+    fprintf(stderr, RED "lookup is not supported on Windows\n" RESET);
+    return -1;
+}
+
+#else //POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static void put_le(FILE* f, unsigned long long value, int bytes) {
+    for (int i = 0; i < bytes; ++i) fputc((int)((value >> (8 * i)) & 0xFF), f);
+}
+
+static unsigned long long get_le(const unsigned char* p, int bytes) {
+    unsigned long long value = 0;
+    for (int i = bytes - 1; i >= 0; --i) value = (value << 8) | p[i];
+    return value;
+}
+
+static char* pack_path(const char* dir, const char* name) {
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char* path = malloc(len);
+    if (path) snprintf(path, len, "%s/%s", dir, name);
+    return path;
+}
+
+int pack_init(pack_t* pack, const char* dest_root, size_t threshold) {
+    memset(pack, 0, sizeof(*pack));
+    pack->threshold = threshold;
+    pack->root_len = strlen(dest_root);
+
+    pack->dir = pack_path(dest_root, PACK_DIR);
+    if (!pack->dir) return -1;
+
+    if (mkdir(pack->dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, RED "Cannot create pack directory \"%s\": %s\n" RESET, pack->dir, strerror(errno));
+        free(pack->dir);
+        return -1;
+    }
+
+    // A new run replaces the previous one: its packs may be more than this run's workers will rewrite.
+    DIR* dir = opendir(pack->dir);
+    if (dir) {
+        struct dirent* entry;
+        while ((entry = readdir(dir))) {
+            size_t name_len = strlen(entry->d_name);
+            int is_pack = name_len > 9 && strncmp(entry->d_name, "pack-", 5) == 0 && strcmp(entry->d_name + name_len - 4, ".dat") == 0;
+            if (is_pack || strcmp(entry->d_name, PACK_INDEX) == 0) unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+        closedir(dir);
+    }
+
+    if (pthread_mutex_init(&pack->mutex, NULL) != 0) {
+        fprintf(stderr, RED "Cannot create mutex in pack_t\n" RESET);
+        free(pack->dir);
+        return -1;
+    }
+    return 0;
+}
+
+static pack_writer_t* open_writer(pack_t* pack, int worker_id) {
+    char name[32];
+    snprintf(name, sizeof(name), "pack-%04d.dat", worker_id);
+
+    char* path = pack_path(pack->dir, name);
+    pack_writer_t* writer = calloc(1, sizeof(pack_writer_t));
+    if (!path || !writer) goto fail;
+
+    writer->id = worker_id;
+    writer->buffer = malloc(PACK_BUFFER);
+    if (!writer->buffer) goto fail;
+
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd == -1) {
+        fprintf(stderr, RED "Cannot create pack \"%s\": %s\n" RESET, path, strerror(errno));
+        goto fail;
+    }
+    free(path);
+
+    pthread_mutex_lock(&pack->mutex);
+    writer->next = pack->writers;
+    pack->writers = writer;
+    pack->pack_count = MAX(pack->pack_count, worker_id + 1);
+    pthread_mutex_unlock(&pack->mutex);
+
+    return writer;
+
+fail:
+    if (writer) free(writer->buffer);
+    free(writer);
+    free(path);
+    return NULL;
+}
+
+static int add_slot(pack_writer_t* writer, const char* rel, const struct stat* st, unsigned long long length) {
+    size_t rel_len = strlen(rel);
+
+    if (writer->count == writer->capacity) {
+        size_t capacity = MAX(writer->capacity * 2, (size_t)1024);
+        pack_slot_t* slots = realloc(writer->slots, capacity * sizeof(pack_slot_t));
+        if (!slots) return ENOMEM;
+        writer->slots = slots;
+        writer->capacity = capacity;
+    }
+    if (writer->names_size + rel_len > writer->names_capacity) {
+        size_t capacity = MAX(writer->names_capacity * 2, writer->names_size + rel_len + 64 * KILO_BYTE);
+        char* names = realloc(writer->names, capacity);
+        if (!names) return ENOMEM;
+        writer->names = names;
+        writer->names_capacity = capacity;
+    }
+
+    pack_slot_t* slot = &writer->slots[writer->count++];
+    slot->name_offset = writer->names_size;
+    slot->name_len = rel_len;
+    slot->offset = writer->offset;
+    slot->length = length;
+    slot->mode = (unsigned int)st->st_mode;
+    slot->mtime = (long long)st->st_mtime;
+
+    memcpy(writer->names + writer->names_size, rel, rel_len);
+    writer->names_size += rel_len;
+
+    return 0;
+}
+
+int pack_file(pack_t* pack, pack_writer_t** writer, int worker_id, const char* src, const char* dest, worker_stats_t* thread_stat) {
+    if (!*writer && !(*writer = open_writer(pack, worker_id))) return EIO;
+    pack_writer_t* w = *writer;
+
+    if (throttle_enabled) throttle_open();
+    int fd = open(src, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) {
+        fprintf(stderr, RED "pack_file error: Cannot open source file \"%s\"\n" RESET, src);
+        return errno;
+    }
+
+    int error_code = 0;
+    unsigned long long copied = 0;
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        error_code = errno;
+        goto cleanup;
+    }
+
+    ssize_t bytes_read = 0;
+    while ((bytes_read = read(fd, w->buffer, PACK_BUFFER)) > 0) {
+        if (throttle_enabled) {
+            throttle_read((size_t)bytes_read);
+            throttle_write((size_t)bytes_read);
+        }
+        for (ssize_t done = 0; done < bytes_read; ) {
+            ssize_t written = pwrite(w->fd, w->buffer + done, (size_t)(bytes_read - done), (off_t)(w->offset + copied + done));
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) {
+                error_code = written < 0 ? errno : EIO;
+                fprintf(stderr, RED "pack_file error: Write failed for pack %04d\n" RESET, w->id);
+                goto cleanup;
+            }
+            done += written;
+        }
+        copied += (unsigned long long)bytes_read;
+    }
+    if (bytes_read < 0) {
+        error_code = errno;
+        fprintf(stderr, RED "pack_file error: Read failed for \"%s\"\n" RESET, src);
+        goto cleanup;
+    }
+
+    const char* rel = dest + pack->root_len;
+    while (*rel == '/') ++rel;
+
+    // A failed file leaves unreferenced bytes behind, which the next one simply overwrites.
+    if ((error_code = add_slot(w, rel, &st, copied)) != 0) goto cleanup;
+    w->offset += copied;
+
+    ++thread_stat->total_files;
+    thread_stat->total_bytes += copied;
+
+cleanup:
+    close(fd);
+    return error_code;
+}
+
+typedef struct pack_ref_t {
+    const pack_writer_t* writer;
+    const pack_slot_t* slot;
+} pack_ref_t;
+
+static int compare_refs(const void* a, const void* b) {
+    const pack_ref_t* left = (const pack_ref_t*)a;
+    const pack_ref_t* right = (const pack_ref_t*)b;
+    size_t left_len = left->slot->name_len;
+    size_t right_len = right->slot->name_len;
+
+    int res = memcmp(left->writer->names + left->slot->name_offset, right->writer->names + right->slot->name_offset, MIN(left_len, right_len));
+    if (res != 0) return res;
+    return left_len < right_len ? -1 : left_len > right_len;
+}
+
+static int write_index(pack_t* pack, pack_ref_t* refs, size_t count, size_t strings_size) {
+    char* tmp_path = pack_path(pack->dir, PACK_INDEX ".tmp");
+    char* index_path = pack_path(pack->dir, PACK_INDEX);
+    int error_code = 0;
+    FILE* f = NULL;
+
+    if (!tmp_path || !index_path) {
+        error_code = ENOMEM;
+        goto cleanup;
+    }
+
+    f = fopen(tmp_path, "wb");
+    if (!f) {
+        error_code = errno;
+        fprintf(stderr, RED "Cannot create pack index \"%s\": %s\n" RESET, tmp_path, strerror(errno));
+        goto cleanup;
+    }
+
+    unsigned long long strings_offset = PACK_HEADER_SIZE + (unsigned long long)count * PACK_RECORD_SIZE;
+
+    fwrite(PACK_MAGIC, 1, 8, f);
+    put_le(f, PACK_VERSION, 4);
+    put_le(f, (unsigned long long)pack->pack_count, 4);
+    put_le(f, count, 8);
+    put_le(f, strings_offset, 8);
+    put_le(f, strings_size, 8);
+
+    unsigned long long name_offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const pack_slot_t* slot = refs[i].slot;
+
+        put_le(f, name_offset, 8);
+        put_le(f, slot->name_len, 4);
+        put_le(f, (unsigned long long)refs[i].writer->id, 4);
+        put_le(f, slot->offset, 8);
+        put_le(f, slot->length, 8);
+        put_le(f, slot->mode, 4);
+        put_le(f, 0, 4);
+        put_le(f, (unsigned long long)slot->mtime, 8);
+
+        name_offset += slot->name_len;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        fwrite(refs[i].writer->names + refs[i].slot->name_offset, 1, refs[i].slot->name_len, f);
+    }
+
+    if (fclose(f) != 0) {
+        error_code = errno;
+        fprintf(stderr, RED "Cannot write pack index \"%s\": %s\n" RESET, tmp_path, strerror(errno));
+        goto cleanup;
+    }
+
+    // Readers only ever see a complete index.
+    if (rename(tmp_path, index_path) != 0) error_code = errno;
+
+cleanup:
+    free(tmp_path);
+    free(index_path);
+    return error_code;
+}
+
+int pack_finish(pack_t* pack) {
+    int error_code = 0;
+    size_t count = 0;
+    size_t strings_size = 0;
+
+    for (pack_writer_t* w = pack->writers; w; w = w->next) {
+        count += w->count;
+        strings_size += w->names_size;
+        if (sync_mode == SYNC_FILE && fdatasync(w->fd) != 0 && error_code == 0) error_code = errno;
+        if (close(w->fd) != 0 && error_code == 0) error_code = errno;
+    }
+
+    pack_ref_t* refs = malloc(MAX(count, (size_t)1) * sizeof(pack_ref_t));
+    if (!refs) {
+        error_code = ENOMEM;
+    } else {
+        size_t n = 0;
+        for (pack_writer_t* w = pack->writers; w; w = w->next) {
+            for (size_t i = 0; i < w->count; ++i) {
+                refs[n].writer = w;
+                refs[n].slot = &w->slots[i];
+                pack->packed_bytes += w->slots[i].length;
+                ++n;
+            }
+        }
+        pack->packed_files = count;
+
+        qsort(refs, count, sizeof(pack_ref_t), compare_refs);
+
+        int res = write_index(pack, refs, count, strings_size);
+        if (error_code == 0) error_code = res;
+        free(refs);
+    }
+
+    while (pack->writers) {
+        pack_writer_t* w = pack->writers;
+        pack->writers = w->next;
+
+        free(w->buffer);
+        free(w->slots);
+        free(w->names);
+        free(w);
+    }
+    free(pack->dir);
+    pack->dir = NULL;
+    pthread_mutex_destroy(&pack->mutex);
+
+    return error_code;
+}
+
+int pack_index_open(pack_index_t* index, const char* dest_root) {
+    memset(index, 0, sizeof(*index));
+
+    index->dir = pack_path(dest_root, PACK_DIR);
+    char* path = index->dir ? pack_path(index->dir, PACK_INDEX) : NULL;
+    if (!path) {
+        free(index->dir);
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        fprintf(stderr, RED "Cannot open pack index \"%s\": %s\n" RESET, path, strerror(errno));
+        if (fd != -1) close(fd);
+        goto fail;
+    }
+
+    index->size = (size_t)st.st_size;
+    void* data = index->size >= PACK_HEADER_SIZE ? mmap(NULL, index->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, RED "Cannot map pack index \"%s\"\n" RESET, path);
+        goto fail;
+    }
+    index->data = (const unsigned char*)data;
+
+    unsigned long long count = get_le(index->data + 16, 8);
+    unsigned long long strings_offset = get_le(index->data + 24, 8);
+    unsigned long long strings_size = get_le(index->data + 32, 8);
+    unsigned long long pack_count = get_le(index->data + 12, 4);
+
+    // Every size is checked against the mapping before it is multiplied or added, so a corrupt header cannot wrap around.
+    if (memcmp(index->data, PACK_MAGIC, 8) != 0 || get_le(index->data + 8, 4) != PACK_VERSION ||
+        count > (index->size - PACK_HEADER_SIZE) / PACK_RECORD_SIZE ||
+        strings_offset != PACK_HEADER_SIZE + count * PACK_RECORD_SIZE || strings_size > index->size - strings_offset ||
+        pack_count > PACK_MAX_PACKS || (pack_count == 0 && count > 0)) {
+        fprintf(stderr, RED "\"%s\" is not a valid pack index\n" RESET, path);
+        munmap(data, index->size);
+        goto fail;
+    }
+
+    index->pack_count = (unsigned int)pack_count;
+    index->count = (size_t)count;
+    index->records = index->data + PACK_HEADER_SIZE;
+    index->strings = index->data + strings_offset;
+    index->strings_size = (size_t)strings_size;
+
+    free(path);
+    return 0;
+
+fail:
+    free(path);
+    free(index->dir);
+    index->dir = NULL;
+    return -1;
+}
+
+void pack_index_close(pack_index_t* index) {
+    if (index->data) munmap((void*)index->data, index->size);
+    free(index->dir);
+    memset(index, 0, sizeof(*index));
+}
+
+void pack_index_entry(const pack_index_t* index, size_t i, pack_entry_t* entry) {
+    const unsigned char* record = index->records + i * PACK_RECORD_SIZE;
+    unsigned long long name_offset = get_le(record, 8);
+
+    entry->path_len = (size_t)get_le(record + 8, 4);
+    if (name_offset > index->strings_size || entry->path_len > index->strings_size - name_offset) {
+        name_offset = 0;
+        entry->path_len = 0;
+    }
+    entry->path = (const char*)index->strings + name_offset;
+    entry->pack = (unsigned int)get_le(record + 12, 4);
+    entry->offset = get_le(record + 16, 8);
+    entry->length = get_le(record + 24, 8);
+    entry->mode = (unsigned int)get_le(record + 32, 4);
+    entry->mtime = (long long)get_le(record + 40, 8);
+}
+
+int pack_lookup(const pack_index_t* index, const char* path, pack_entry_t* entry) {
+    size_t path_len = strlen(path);
+    size_t low = 0;
+    size_t high = index->count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        pack_index_entry(index, mid, entry);
+
+        int res = memcmp(entry->path, path, MIN(entry->path_len, path_len));
+        if (res == 0) res = entry->path_len < path_len ? -1 : entry->path_len > path_len;
+
+        if (res == 0) return 0;
+        if (res < 0) low = mid + 1;
+        else high = mid;
+    }
+    return ENOENT;
+}
+
+// Index paths come from a file that may have been tampered with: only plain relative paths stay inside out_dir.
+static int safe_relative_path(const char* path, size_t len) {
+    if (len == 0 || path[0] == '/' || memchr(path, '\0', len)) return FALSE;
+
+    for (size_t start = 0; start < len; ) {
+        const char* slash = memchr(path + start, '/', len - start);
+        size_t end = slash ? (size_t)(slash - path) : len;
+        size_t part = end - start;
+
+        if (part == 0 || (part == 1 && path[start] == '.') || (part == 2 && path[start] == '.' && path[start + 1] == '.')) return FALSE;
+        start = end + 1;
+        if (slash && start == len) return FALSE;
+    }
+    return TRUE;
+}
+
+static int extract_entry(const pack_entry_t* entry, int pack_fd, const char* out_dir, char* buffer) {
+    if (!safe_relative_path(entry->path, entry->path_len)) {
+        fprintf(stderr, RED "unpack error: Refusing unsafe path \"%.*s\"\n" RESET, (int)entry->path_len, entry->path);
+        return EINVAL;
+    }
+
+    size_t len = strlen(out_dir) + entry->path_len + 2;
+    char* path = malloc(len);
+    if (!path) return ENOMEM;
+    snprintf(path, len, "%s/%.*s", out_dir, (int)entry->path_len, entry->path);
+
+    int error_code = make_parents(path);
+    int fd = error_code == 0 ? open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, entry->mode & 07777) : -1;
+    if (fd == -1) {
+        if (error_code == 0) error_code = errno;
+        fprintf(stderr, RED "unpack error: Cannot create \"%s\", code: %d\n" RESET, path, error_code);
+        free(path);
+        return error_code;
+    }
+
+    unsigned long long done = 0;
+    while (done < entry->length && error_code == 0) {
+        size_t chunk = (size_t)MIN(entry->length - done, (unsigned long long)PACK_BUFFER);
+        ssize_t n = pread(pack_fd, buffer, chunk, (off_t)(entry->offset + done));
+        if (n <= 0) {
+            error_code = n < 0 ? errno : EIO;
+            break;
+        }
+
+        ssize_t written = 0;
+        while (written < n) {
+            ssize_t w = write(fd, buffer + written, (size_t)(n - written));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                error_code = w < 0 ? errno : EIO;
+                break;
+            }
+            written += w;
+        }
+        done += (unsigned long long)n;
+    }
+
+    struct timespec times[2] = {
+        { .tv_sec = (time_t)entry->mtime, .tv_nsec = 0 },
+        { .tv_sec = (time_t)entry->mtime, .tv_nsec = 0 }
+    };
+    if (error_code == 0) futimens(fd, times);
+    if (close(fd) != 0 && error_code == 0) error_code = errno;
+
+    if (error_code != 0) fprintf(stderr, RED "unpack error: Cannot extract \"%s\", code: %d\n" RESET, path, error_code);
+    free(path);
+    return error_code;
+}
+
+int pack_unpack(const char* dest_root, const char* out_dir) {
+    pack_index_t index;
+    if (pack_index_open(&index, dest_root) != 0) return -1;
+
+    int* pack_fds = malloc(MAX(index.pack_count, 1u) * sizeof(int));
+    char* buffer = malloc(PACK_BUFFER);
+    if (!pack_fds || !buffer) {
+        free(pack_fds);
+        free(buffer);
+        pack_index_close(&index);
+        return -1;
+    }
+    for (unsigned int p = 0; p < index.pack_count; ++p) pack_fds[p] = -1;
+
+    size_t extracted = 0;
+    size_t failed = 0;
+    unsigned long long bytes = 0;
+
+    for (size_t i = 0; i < index.count; ++i) {
+        pack_entry_t entry;
+        pack_index_entry(&index, i, &entry);
+
+        if (entry.pack >= index.pack_count) {
+            ++failed;
+            continue;
+        }
+        if (pack_fds[entry.pack] == -1) {
+            char name[32];
+            snprintf(name, sizeof(name), "pack-%04u.dat", entry.pack);
+            char* path = pack_path(index.dir, name);
+            pack_fds[entry.pack] = path ? open(path, O_RDONLY) : -1;
+            if (pack_fds[entry.pack] == -1) fprintf(stderr, RED "unpack error: Cannot open pack \"%s\"\n" RESET, path ? path : name);
+            free(path);
+        }
+
+        if (pack_fds[entry.pack] != -1 && extract_entry(&entry, pack_fds[entry.pack], out_dir, buffer) == 0) {
+            ++extracted;
+            bytes += entry.length;
+        } else {
+            ++failed;
+        }
+    }
+
+    for (unsigned int p = 0; p < index.pack_count; ++p) {
+        if (pack_fds[p] != -1) close(pack_fds[p]);
+    }
+    free(pack_fds);
+    free(buffer);
+    pack_index_close(&index);
+
+    printf(
+        GRN "\nUnpacked \"%s\" into \"%s\".\n"
+        YEL "Files extracted: %zu, failed: %zu\n"
+        CYN "Total extracted size: %llu bytes\n"
+        RESET, dest_root, out_dir, extracted, failed, bytes
+    );
+    return failed == 0 ? 0 : -1;
+}
+
+int pack_print_lookup(const char* dest_root, char* const* paths, int count) {
+    pack_index_t index;
+    if (pack_index_open(&index, dest_root) != 0) return -1;
+
+    int missing = 0;
+    for (int i = 0; i < count; ++i) {
+        const char* path = paths[i];
+        while (*path == '/') ++path;
+
+        pack_entry_t entry;
+        if (pack_lookup(&index, path, &entry) != 0) {
+            printf("%s\tnot packed\n", path);
+            ++missing;
+            continue;
+        }
+        printf(
+            "%s\t" PACK_DIR "/pack-%04u.dat\t%llu\t%llu\t%o\t%lld\n",
+            path, entry.pack, entry.offset, entry.length, entry.mode & 07777, entry.mtime
+        );
+    }
+
+    pack_index_close(&index);
+    return missing == 0 ? 0 : -1;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "core.h"
+
+#define PACK_DIR ".copyer-pack"
+#define PACK_INDEX "index.idx"
+#define PACK_MAGIC "CPYPACK1"
+#define PACK_VERSION 1
+
+#define PACK_HEADER_SIZE 40
+#define PACK_RECORD_SIZE 48
+#define PACK_BUFFER ((size_t)256 * KILO_BYTE)
+// One pack per worker; an index claiming more is rejected as corrupt.
+#define PACK_MAX_PACKS 65536
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pack_slot_t {
+    size_t name_offset;
+    size_t name_len;
+    unsigned long long offset;
+    unsigned long long length;
+    unsigned int mode;
+    long long mtime;
+} pack_slot_t;
+
+// One pack file per worker, appended to without any locking; the entries stay in memory
+// until pack_finish() merges them into the index.
+typedef struct pack_writer_t {
+    int id;
+    int fd;
+    unsigned long long offset;
+    char* buffer;
+
+    pack_slot_t* slots;
+    size_t count;
+    size_t capacity;
+
+    char* names;
+    size_t names_size;
+    size_t names_capacity;
+
+    struct pack_writer_t* next;
+} pack_writer_t;
+
+// Small-file output mode: files below threshold are appended to <dest>/.copyer-pack/pack-NNNN.dat
+// instead of being created one by one, and found again through a sorted index:
+//   header  "CPYPACK1", u32 version, u32 pack count, u64 entries, u64 strings offset, u64 strings size
+//   records u64 path offset, u32 path length, u32 pack, u64 offset, u64 length, u32 mode, u32 0, i64 mtime
+//   strings the paths (relative to the destination), no terminators
+// Records are fixed-size, little-endian and sorted by path, so the index is searched in place through mmap.
+typedef struct pack_t {
+    char* dir;
+    size_t root_len;
+    size_t threshold;
+
+    pthread_mutex_t mutex;
+    pack_writer_t* writers;
+    int pack_count;
+
+    size_t packed_files;
+    size_t packed_bytes;
+} pack_t;
+
+typedef struct pack_entry_t {
+    const char* path;
+    size_t path_len;
+    unsigned int pack;
+    unsigned long long offset;
+    unsigned long long length;
+    unsigned int mode;
+    long long mtime;
+} pack_entry_t;
+
+typedef struct pack_index_t {
+    char* dir;
+    const unsigned char* data;
+    size_t size;
+    size_t count;
+    unsigned int pack_count;
+    const unsigned char* records;
+    const unsigned char* strings;
+    size_t strings_size;
+} pack_index_t;
+
+int pack_init(pack_t* pack, const char* dest_root, size_t threshold);
+
+// Appends src to the calling worker's pack; *writer caches that worker's pack between calls.
+int pack_file(pack_t* pack, pack_writer_t** writer, int worker_id, const char* src, const char* dest, worker_stats_t* thread_stat);
+
+// Closes the packs and writes the index. Returns 0 or an errno-style code.
+int pack_finish(pack_t* pack);
+
+int pack_index_open(pack_index_t* index, const char* dest_root);
+void pack_index_close(pack_index_t* index);
+void pack_index_entry(const pack_index_t* index, size_t i, pack_entry_t* entry);
+
+// Binary search over the mapped index. Returns 0 and fills entry, or ENOENT.
+int pack_lookup(const pack_index_t* index, const char* path, pack_entry_t* entry);
+
+// Subcommands: "unpack <dest> <out_dir>" and "lookup <dest> <path>...".
+int pack_unpack(const char* dest_root, const char* out_dir);
+int pack_print_lookup(const char* dest_root, char* const* paths, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include "physicalOrder.h"
+#include "throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+int parse_physical_order(const char* s, int* out) {
+    if (strcmp(s, "off") == 0) *out = PHYSICAL_ORDER_OFF;
+    else if (strcmp(s, "on") == 0) *out = PHYSICAL_ORDER_ON;
+    else if (strcmp(s, "auto") == 0) *out = PHYSICAL_ORDER_AUTO;
+    else return -1;
+
+    return 0;
+}
+
+#ifdef _WIN32
+
+unsigned long long physical_key(const copy_task_t* task, int* fiemap_state) {
+    (void)fiemap_state;
+    return task->kind == TASK_HARDLINK ? ULLONG_MAX : 0;
+}
+
+#else //POSIX
+
+#ifdef __linux__
+static int first_extent(int fd, unsigned long long* physical) {
+    union {
+        struct fiemap map;
+        char raw[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.map.fm_start = 0;
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.map) != 0) return -1;
+
+    // Holes-only and inline-data files have no extent to seek to.
+    *physical = request.map.fm_mapped_extents > 0 ? request.map.fm_extents[0].fe_physical : 0;
+    return 0;
+}
+#endif
+
+unsigned long long physical_key(const copy_task_t* task, int* fiemap_state) {
+    // A hardlink waits for the copy of its inode, so it must never be queued ahead of it.
+    if (task->kind == TASK_HARDLINK) return ULLONG_MAX;
+    if (task->kind != TASK_COPY && task->kind != TASK_REFRESH) return 0;
+    if (task->file_size == 0) return 0;
+
+    // The scanner already lstat()ed the entry, so the inode fallback costs no system call.
+    if (*fiemap_state < 0) return task->ino;
+
+#ifdef __linux__
+    // This open is on top of the worker's, and counts toward --open-limit like it.
+    if (throttle_enabled) throttle_open();
+    int fd = open(task->source_path, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) return task->ino;
+
+    unsigned long long key = 0;
+    if (first_extent(fd, &key) != 0) {
+        if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL) *fiemap_state = -1;
+        key = task->ino;
+    }
+    close(fd);
+
+    return key;
+#else
+    *fiemap_state = -1;
+    return task->ino;
+#endif
+}
+
+#endif
+
+static int compare_ordered(const void* a, const void* b) {
+    const ordered_task_t* left = (const ordered_task_t*)a;
+    const ordered_task_t* right = (const ordered_task_t*)b;
+
+    if (left->key != right->key) return left->key < right->key ? -1 : 1;
+    if (left->seq != right->seq) return left->seq < right->seq ? -1 : 1;
+    return 0;
+}
+
+void sort_window(ordered_task_t* window, size_t count) {
+    qsort(window, count, sizeof(ordered_task_t), compare_ordered);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef PHYSICAL_ORDER_H
+#define PHYSICAL_ORDER_H
+
+#include "core.h"
+
+#define PHYSICAL_ORDER_WINDOW 4096
+
+#define PHYSICAL_ORDER_OFF  0
+#define PHYSICAL_ORDER_ON   1
+#define PHYSICAL_ORDER_AUTO 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ordered_task_t {
+    unsigned long long key;
+    size_t seq;
+    copy_task_t task;
+} ordered_task_t;
+
+int parse_physical_order(const char* s, int* out);
+
+// Sort key approximating where the task's data starts on disk: the first FIEMAP extent, or the
+// inode number the scan recorded when the filesystem has no FIEMAP (*fiemap_state then becomes -1
+// and later calls skip the open, which is charged to --open-limit). Tasks without file data get 0, so directories and symlinks go first. Hardlinks get
+// ULLONG_MAX and go last, behind the copy of their inode they wait for.
+unsigned long long physical_key(const copy_task_t* task, int* fiemap_state);
+
+// Orders by key; equal keys keep their scan order.
+void sort_window(ordered_task_t* window, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
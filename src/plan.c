@@ -0,0 +1,288 @@
+#include "plan.h"
+#include "taskQueue.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+static const size_t class_bounds[PLAN_SIZE_CLASSES - 1] = {
+    4 * KILO_BYTE, 64 * KILO_BYTE, MEGA_BYTE, 16 * MEGA_BYTE, 256 * MEGA_BYTE, 4 * GIGA_BYTE
+};
+
+static const char* class_names[PLAN_SIZE_CLASSES] = {
+    "< 4K", "< 64K", "< 1M", "< 16M", "< 256M", "< 4G", ">= 4G"
+};
+
+static int size_class(size_t size) {
+    int i = 0;
+    while (i < PLAN_SIZE_CLASSES - 1 && size >= class_bounds[i]) ++i;
+    return i;
+}
+
+// Manifest integers are little-endian regardless of the host.
+static void put_le(FILE* f, unsigned long long value, int bytes) {
+    for (int i = 0; i < bytes; ++i) fputc((int)((value >> (8 * i)) & 0xFF), f);
+}
+
+int plan_init(plan_t* plan, const char* manifest_path, const char* src_root, int num_workers) {
+    memset(plan, 0, sizeof(*plan));
+
+    plan->src_root_len = strlen(src_root);
+    plan->num_workers = num_workers;
+
+    plan->manifest = fopen(manifest_path, "wb");
+    if (!plan->manifest) {
+        fprintf(stderr, RED "Cannot create manifest \"%s\": %s\n" RESET, manifest_path, strerror(errno));
+        return -1;
+    }
+
+    fwrite(PLAN_MAGIC, 1, 8, plan->manifest);
+    put_le(plan->manifest, 1, 4);
+    return 0;
+}
+
+int plan_finish(plan_t* plan) {
+    int res = 0;
+
+    if (plan->manifest) {
+        put_le(plan->manifest, 0xFF, 1);
+        put_le(plan->manifest, plan->files + plan->dirs + plan->links, 8);
+        put_le(plan->manifest, plan->bytes, 8);
+        fwrite(PLAN_END_MAGIC, 1, 8, plan->manifest);
+
+        if (fclose(plan->manifest) != 0) res = -1;
+        plan->manifest = NULL;
+    }
+
+    for (int i = 0; i < PLAN_SMALL_SAMPLES; ++i) free(plan->small_samples[i]);
+    free(plan->large_sample);
+
+    return res;
+}
+
+static void keep_samples(plan_t* plan, const copy_task_t* task) {
+    if (task->file_size < 64 * KILO_BYTE) {
+        // Reservoir sampling keeps the open-latency probe representative of the whole tree.
+        size_t slot = plan->small_seen < PLAN_SMALL_SAMPLES ? plan->small_seen : (size_t)rand() % (plan->small_seen + 1);
+        ++plan->small_seen;
+
+        if (slot < PLAN_SMALL_SAMPLES) {
+            char* path = strdup(task->source_path);
+            if (path) {
+                free(plan->small_samples[slot]);
+                plan->small_samples[slot] = path;
+            }
+        }
+    } else if (task->file_size > plan->large_size) {
+        char* path = strdup(task->source_path);
+        if (path) {
+            free(plan->large_sample);
+            plan->large_sample = path;
+            plan->large_size = task->file_size;
+        }
+    }
+}
+
+static void plan_record(plan_t* plan, const copy_task_t* task) {
+    switch (task->kind) {
+    case TASK_MKDIR:
+        ++plan->dirs;
+        break;
+    case TASK_SYMLINK:
+    case TASK_HARDLINK:
+        ++plan->links;
+        break;
+    default: {
+        int cls = size_class(task->file_size);
+        ++plan->files;
+        plan->bytes += task->file_size;
+        ++plan->class_files[cls];
+        plan->class_bytes[cls] += task->file_size;
+        keep_samples(plan, task);
+        break;
+    }
+    }
+
+    const char* rel = task->source_path + plan->src_root_len;
+    while (*rel == '/' || *rel == '\\') ++rel;
+    size_t rel_len = MIN(strlen(rel), (size_t)0xFFFF);
+
+    put_le(plan->manifest, (unsigned long long)task->kind, 1);
+    put_le(plan->manifest, task->file_size, 8);
+    put_le(plan->manifest, rel_len, 2);
+    fwrite(rel, 1, rel_len, plan->manifest);
+}
+
+void* planner_thread(void* arg) {
+    thread_context_t* cont = (thread_context_t*)arg;
+    copy_task_t current_tasks_batch[WORKER_BATCH_SIZE];
+
+    trace_thread_name("planner", cont->id);
+
+    for (;;) {
+        int batch_count = queue_pop_batch(cont->queue, current_tasks_batch, WORKER_BATCH_SIZE);
+        if (batch_count < 0) break;
+
+        for (int i = 0; i < batch_count; ++i) {
+            plan_record(cont->plan, &current_tasks_batch[i]);
+
+            free(current_tasks_batch[i].source_path);
+            free(current_tasks_batch[i].dest_path);
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef _WIN32
+
+void plan_probe(plan_t* plan, const char* dest_dir) {
+    (void)plan; (void)dest_dir;
+    fprintf(stderr, YEL "plan: device probes are not supported on Windows, no time estimate\n" RESET);
+}
+
+#else //POSIX
+
+static void probe_source(plan_t* plan, char* buffer) {
+    if (plan->large_sample) {
+        int fd = open(plan->large_sample, O_RDONLY);
+        if (fd != -1) {
+            // Drop cached pages first so the probe measures the device rather than memory.
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+            size_t total = 0;
+            ssize_t n = 0;
+            double start = monotonic_seconds();
+            while (total < PLAN_PROBE_BYTES && (n = read(fd, buffer, MEGA_BYTE)) > 0) total += (size_t)n;
+            double elapsed = monotonic_seconds() - start;
+            close(fd);
+
+            if (total >= MEGA_BYTE && elapsed > 0) plan->src_read_bps = (double)total / elapsed;
+        }
+    }
+
+    int opened = 0;
+    double start = monotonic_seconds();
+    for (int i = 0; i < PLAN_SMALL_SAMPLES; ++i) {
+        if (!plan->small_samples[i]) continue;
+
+        int fd = open(plan->small_samples[i], O_RDONLY);
+        if (fd == -1) continue;
+
+        struct stat st;
+        fstat(fd, &st);
+        if (read(fd, buffer, 4 * KILO_BYTE) >= 0) ++opened;
+        close(fd);
+    }
+    if (opened > 0) plan->src_open_sec = (monotonic_seconds() - start) / opened;
+}
+
+static void probe_dest(plan_t* plan, const char* dest_dir, char* buffer) {
+    char dir[MAX_PATH - 64];
+    char path[MAX_PATH];
+    struct stat st;
+
+    snprintf(dir, sizeof(dir), "%s", dest_dir);
+    if (stat(dir, &st) != 0) {
+        char* slash = strrchr(dir, '/');
+        if (slash && slash != dir) *slash = '\0';
+        else snprintf(dir, sizeof(dir), "%s", slash ? "/" : ".");
+    }
+
+    snprintf(path, sizeof(path), "%s/.copyer-probe-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        fprintf(stderr, YEL "plan: cannot probe destination \"%s\": %s\n" RESET, dir, strerror(errno));
+        return;
+    }
+
+    size_t total = 0;
+    double start = monotonic_seconds();
+    while (total < PLAN_PROBE_BYTES / 4) {
+        ssize_t n = write(fd, buffer, MEGA_BYTE);
+        if (n <= 0) break;
+        total += (size_t)n;
+    }
+    fdatasync(fd);
+    double elapsed = monotonic_seconds() - start;
+    close(fd);
+    unlink(path);
+
+    if (total > 0 && elapsed > 0) plan->dest_write_bps = (double)total / elapsed;
+
+    int created = 0;
+    start = monotonic_seconds();
+    for (int i = 0; i < PLAN_SMALL_SAMPLES; ++i) {
+        snprintf(path, sizeof(path), "%s/.copyer-probe-%d-%d", dir, (int)getpid(), i);
+
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd == -1) continue;
+        if (write(fd, buffer, 1) == 1) ++created;
+        close(fd);
+    }
+    elapsed = monotonic_seconds() - start;
+
+    for (int i = 0; i < PLAN_SMALL_SAMPLES; ++i) {
+        snprintf(path, sizeof(path), "%s/.copyer-probe-%d-%d", dir, (int)getpid(), i);
+        unlink(path);
+    }
+
+    if (created > 0) plan->dest_create_sec = elapsed / created;
+}
+
+void plan_probe(plan_t* plan, const char* dest_dir) {
+    char* buffer = calloc(1, MEGA_BYTE);
+    if (!buffer) return;
+
+    probe_source(plan, buffer);
+    probe_dest(plan, dest_dir, buffer);
+
+    free(buffer);
+}
+
+#endif
+
+void plan_report(const plan_t* plan) {
+    printf(
+        GRN "\nPlan completed.\n"
+        YEL "Files: %zu, directories: %zu, links: %zu\n"
+        CYN "Total size: %zu bytes\n"
+        RESET, plan->files, plan->dirs, plan->links, plan->bytes
+    );
+
+    printf(BLU "Size histogram:\n" RESET);
+    for (int i = 0; i < PLAN_SIZE_CLASSES; ++i) {
+        printf(WEAK "  %-7s %10zu files %16zu bytes\n" RESET, class_names[i], plan->class_files[i], plan->class_bytes[i]);
+    }
+
+    printf(
+        BLU "Probes: source read %.1f MB/s, source open %.3f ms, destination write %.1f MB/s, destination create %.3f ms\n" RESET,
+        plan->src_read_bps / MEGA_BYTE, plan->src_open_sec * 1e3, plan->dest_write_bps / MEGA_BYTE, plan->dest_create_sec * 1e3
+    );
+
+    // Cost model: data moves at the slower device's bandwidth, per-file costs overlap across workers.
+    double bandwidth = 0;
+    if (plan->src_read_bps > 0 && plan->dest_write_bps > 0) bandwidth = MIN(plan->src_read_bps, plan->dest_write_bps);
+    else bandwidth = MAX(plan->src_read_bps, plan->dest_write_bps);
+
+    if (bandwidth <= 0 && plan->bytes > 0) {
+        printf(YEL "Estimated copy time: unknown (probes did not run)\n" RESET);
+        return;
+    }
+
+    double data_time = bandwidth > 0 ? (double)plan->bytes / bandwidth : 0;
+    double meta_time = (double)(plan->files + plan->links + plan->dirs) * (plan->src_open_sec + plan->dest_create_sec) / MAX(plan->num_workers, 1);
+    double total = data_time + meta_time;
+
+    printf(
+        PRP "Estimated copy time: %.1f sec (%.1f sec data, %.1f sec per-file overhead with %d workers)\n" RESET,
+        total, data_time, meta_time, plan->num_workers
+    );
+}
\ No newline at end of file
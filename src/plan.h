@@ -0,0 +1,55 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "core.h"
+
+#define PLAN_SIZE_CLASSES 7
+#define PLAN_SMALL_SAMPLES 16
+#define PLAN_PROBE_BYTES ((size_t)64 * MEGA_BYTE)
+
+#define PLAN_MAGIC "CPYPLAN1"
+#define PLAN_END_MAGIC "CPYPLEND"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Scan-only run: the planner consumes tasks instead of copying them, writes a manifest
+// and estimates the copy time from short probes of the source and destination devices.
+typedef struct plan_t {
+    FILE* manifest;
+    size_t src_root_len;
+    int num_workers;
+
+    size_t files;
+    size_t dirs;
+    size_t links;
+    size_t bytes;
+    size_t class_files[PLAN_SIZE_CLASSES];
+    size_t class_bytes[PLAN_SIZE_CLASSES];
+
+    char* small_samples[PLAN_SMALL_SAMPLES];
+    size_t small_seen;
+    char* large_sample;
+    size_t large_size;
+
+    double src_read_bps;
+    double src_open_sec;
+    double dest_write_bps;
+    double dest_create_sec;
+} plan_t;
+
+int plan_init(plan_t* plan, const char* manifest_path, const char* src_root, int num_workers);
+int plan_finish(plan_t* plan);
+
+void* planner_thread(void* arg);
+
+// Runs the micro-probes; dest_dir may not exist yet, in which case its parent is probed.
+void plan_probe(plan_t* plan, const char* dest_dir);
+void plan_report(const plan_t* plan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
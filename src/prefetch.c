@@ -0,0 +1,94 @@
+#include "prefetch.h"
+#include "taskQueue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+typedef struct prefetch_item_t {
+    char* path;
+    size_t bytes;
+} prefetch_item_t;
+
+#ifdef _WIN32
+
+static void warm(const prefetch_item_t* item) {
+    (void)item;
+}
+
+#else //POSIX
+
+// WILLNEED starts asynchronous readahead (the same kernel path as readahead(2)) and returns
+// without waiting for the data, so one thread keeps the device busy for many files.
+static void warm(const prefetch_item_t* item) {
+    int fd = open(item->path, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) return;
+
+    posix_fadvise(fd, 0, (off_t)item->bytes, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+#endif
+
+void* prefetch_thread(void* arg) {
+    task_queue_t* queue = (task_queue_t*)arg;
+    prefetch_item_t items[PREFETCH_BATCH];
+
+    pthread_mutex_lock(&queue->mutex);
+    for (;;) {
+        // Workers that overtook the prefetcher consumed those tasks cold; resume behind them.
+        if (queue->prefetch_next < queue->popped) {
+            queue->prefetch_next = queue->popped;
+            queue->prefetch_next_bytes = queue->popped_prefetch_bytes;
+        }
+
+        size_t ahead = queue->prefetch_next - queue->popped;
+        size_t in_flight = queue->prefetch_next_bytes - queue->popped_prefetch_bytes;
+
+        if (ahead >= queue->size) {
+            if (queue->shutdown) break;
+            pthread_cond_wait(&queue->prefetch_wake, &queue->mutex);
+            continue;
+        }
+        if (in_flight >= queue->prefetch_budget) {
+            pthread_cond_wait(&queue->prefetch_wake, &queue->mutex);
+            continue;
+        }
+
+        // Paths are copied under the lock: a worker may pop and free the task while we read it.
+        int count = 0;
+        while (count < PREFETCH_BATCH && ahead < queue->size && in_flight < queue->prefetch_budget) {
+            const copy_task_t* task = &queue->tasks[(queue->head + ahead) % queue->capacity];
+            size_t charge = queue_prefetch_charge(queue, task);
+
+            if (charge > 0) {
+                items[count].path = strdup(task->source_path);
+                items[count].bytes = charge;
+                if (items[count].path) ++count;
+            }
+
+            ++ahead;
+            ++queue->prefetch_next;
+            queue->prefetch_next_bytes += charge;
+            in_flight += charge;
+        }
+        pthread_mutex_unlock(&queue->mutex);
+
+        for (int i = 0; i < count; ++i) {
+            warm(&items[i]);
+
+            ++queue->prefetched_files;
+            queue->prefetched_bytes += items[i].bytes;
+            free(items[i].path);
+        }
+
+        pthread_mutex_lock(&queue->mutex);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return NULL;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "core.h"
+
+#define PREFETCH_BATCH 16
+#define PREFETCH_FILE_BYTES ((size_t)8 * MEGA_BYTE)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One per pool: walks the queue ahead of the workers and asks the kernel to start reading the next
+// files, keeping at most queue->prefetch_budget bytes warmed but not yet picked up by a worker.
+void* prefetch_thread(void* arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
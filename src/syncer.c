@@ -0,0 +1,175 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "syncer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+sync_mode_t sync_mode = SYNC_NONE;
+
+static const char* mode_names[] = { "none", "end", "group", "file" };
+
+int parse_sync_mode(const char* s, sync_mode_t* out) {
+    for (int i = 0; i < (int)(sizeof(mode_names) / sizeof(mode_names[0])); ++i) {
+        if (strcmp(s, mode_names[i]) == 0) {
+            *out = (sync_mode_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* sync_mode_name(sync_mode_t mode) {
+    return mode_names[mode];
+}
+
+#ifdef _WIN32
+
+static void sync_roots(syncer_t* syncer) {
+    (void)syncer;
+}
+
+#else //POSIX
+
+// One syncfs() per filesystem: roots that share a device are flushed once.
+static void sync_roots(syncer_t* syncer) {
+    unsigned long long synced[MAX_DESTINATIONS];
+    int synced_count = 0;
+    double start = monotonic_seconds();
+
+    for (int k = 0; k < syncer->dests->count; ++k) {
+        int fd = open(syncer->dests->roots[k], O_RDONLY | O_DIRECTORY);
+        if (fd == -1) {
+            fprintf(stderr, RED "syncer error: Cannot open \"%s\" for sync, code: %d\n" RESET, syncer->dests->roots[k], errno);
+            continue;
+        }
+
+        struct stat st;
+        int seen = FALSE;
+        int known = fstat(fd, &st) == 0;
+        if (known) {
+            for (int i = 0; i < synced_count && !seen; ++i) seen = synced[i] == (unsigned long long)st.st_dev;
+        }
+
+        if (!seen) {
+#ifdef __linux__
+            if (syncfs(fd) != 0) fprintf(stderr, RED "syncer error: syncfs failed for \"%s\", code: %d\n" RESET, syncer->dests->roots[k], errno);
+#else
+            sync();
+#endif
+            // A root whose device is unknown is synced on its own and never stands in for another.
+            if (known) synced[synced_count++] = (unsigned long long)st.st_dev;
+        }
+        close(fd);
+    }
+
+    pthread_mutex_lock(&syncer->mutex);
+    ++syncer->syncs;
+    syncer->sync_seconds += monotonic_seconds() - start;
+    pthread_mutex_unlock(&syncer->mutex);
+}
+
+#endif
+
+static void* syncer_thread(void* arg) {
+    syncer_t* syncer = (syncer_t*)arg;
+
+    pthread_mutex_lock(&syncer->mutex);
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SYNC_GROUP_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (SYNC_GROUP_INTERVAL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!syncer->stop && syncer->pending < syncer->batch) {
+            if (pthread_cond_timedwait(&syncer->wake, &syncer->mutex, &deadline) == ETIMEDOUT) break;
+        }
+        if (syncer->stop) break;
+        if (syncer->pending == 0) continue;
+
+        // Everything completed so far is covered by this sync; files finishing meanwhile wait for the next one.
+        syncer->pending = 0;
+        pthread_mutex_unlock(&syncer->mutex);
+
+        sync_roots(syncer);
+
+        pthread_mutex_lock(&syncer->mutex);
+    }
+    pthread_mutex_unlock(&syncer->mutex);
+
+    return NULL;
+}
+
+int syncer_start(syncer_t* syncer, sync_mode_t mode, const destination_set_t* dests, size_t batch) {
+    memset(syncer, 0, sizeof(*syncer));
+    syncer->dests = dests;
+    syncer->batch = MAX(batch, 1);
+
+#ifdef _WIN32
+    if (mode == SYNC_END || mode == SYNC_GROUP) {
+        fprintf(stderr, YEL "--sync %s needs syncfs(), using per-file FlushFileBuffers instead\n" RESET, sync_mode_name(mode));
+        mode = SYNC_FILE;
+    }
+#endif
+    sync_mode = mode;
+
+    if (pthread_mutex_init(&syncer->mutex, NULL) != 0) {
+        fprintf(stderr, RED "Cannot create mutex in syncer_t\n" RESET);
+        return -1;
+    }
+    if (pthread_cond_init(&syncer->wake, NULL) != 0) {
+        fprintf(stderr, RED "Cannot initialise condition \"wake\" in syncer_t\n" RESET);
+        pthread_mutex_destroy(&syncer->mutex);
+        return -1;
+    }
+
+    if (mode == SYNC_GROUP) {
+        if (pthread_create(&syncer->thread, NULL, syncer_thread, syncer) != 0) {
+            fprintf(stderr, RED "Cannot create syncer thread\n" RESET);
+            pthread_cond_destroy(&syncer->wake);
+            pthread_mutex_destroy(&syncer->mutex);
+            return -1;
+        }
+        syncer->running = TRUE;
+    }
+
+    return 0;
+}
+
+void syncer_file_done(syncer_t* syncer) {
+    pthread_mutex_lock(&syncer->mutex);
+    if (++syncer->pending >= syncer->batch) pthread_cond_signal(&syncer->wake);
+    pthread_mutex_unlock(&syncer->mutex);
+}
+
+void syncer_finish(syncer_t* syncer) {
+    if (syncer->running) {
+        pthread_mutex_lock(&syncer->mutex);
+        syncer->stop = TRUE;
+        pthread_cond_signal(&syncer->wake);
+        pthread_mutex_unlock(&syncer->mutex);
+
+        pthread_join(syncer->thread, NULL);
+        syncer->running = FALSE;
+    }
+
+    // fdatasync() covers file contents only; the final syncfs() also makes the new directory entries durable.
+    if (sync_mode != SYNC_NONE) sync_roots(syncer);
+
+    pthread_cond_destroy(&syncer->wake);
+    pthread_mutex_destroy(&syncer->mutex);
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef SYNCER_H
+#define SYNCER_H
+
+#include "core.h"
+
+#define DEFAULT_SYNC_BATCH 1024
+#define SYNC_GROUP_INTERVAL_MS 1000
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum sync_mode_t {
+    SYNC_NONE = 0,
+    SYNC_END,
+    SYNC_GROUP,
+    SYNC_FILE
+} sync_mode_t;
+
+// Set once before the workers start; SYNC_FILE makes copy_file() fdatasync every destination before close.
+extern sync_mode_t sync_mode;
+
+// Filesystem-level durability for the destination roots. In group mode a dedicated thread runs
+// syncfs() whenever batch files have completed or the interval has passed, so workers never block on it.
+typedef struct syncer_t {
+    const destination_set_t* dests;
+    size_t batch;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    int running;
+    int stop;
+    size_t pending;
+
+    size_t syncs;
+    double sync_seconds;
+} syncer_t;
+
+int parse_sync_mode(const char* s, sync_mode_t* out);
+const char* sync_mode_name(sync_mode_t mode);
+
+int syncer_start(syncer_t* syncer, sync_mode_t mode, const destination_set_t* dests, size_t batch);
+void syncer_file_done(syncer_t* syncer);
+
+// Stops the group thread and issues the final sync every mode except none needs.
+void syncer_finish(syncer_t* syncer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
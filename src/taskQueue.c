@@ -1,4 +1,5 @@
 #include "taskQueue.h"
+#include "trace.h"
 
 #ifndef _WIN32
 #include <stdlib.h>
@@ -26,6 +27,20 @@ task_queue_t* queue_create(size_t capacity) {
     queue->head = 0;
     queue->tail = 0;
     queue->shutdown = 0;
+    queue->bytes = 0;
+    queue->peak_bytes = 0;
+    queue->high_watermark = 0;
+    queue->low_watermark = 0;
+    queue->pop_bytes = 0;
+    queue->draining = FALSE;
+    queue->popped = 0;
+    queue->popped_prefetch_bytes = 0;
+    queue->prefetch_next = 0;
+    queue->prefetch_next_bytes = 0;
+    queue->prefetch_budget = 0;
+    queue->prefetch_file_bytes = 0;
+    queue->prefetched_files = 0;
+    queue->prefetched_bytes = 0;
 
     if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
         fprintf(stderr, RED "Cannot create mutex in task_queue_t\n" RESET);
@@ -54,10 +69,100 @@ task_queue_t* queue_create(size_t capacity) {
 
         return NULL;
     }
+    if (pthread_cond_init(&queue->prefetch_wake, NULL) != 0) {
+        fprintf(stderr, RED "Cannot initialise condition \"prefetch_wake\" in task_queue_t\n" RESET);
+
+        free(queue->tasks);
+        pthread_cond_destroy(&queue->not_empty);
+        pthread_cond_destroy(&queue->not_full);
+        pthread_mutex_destroy(&queue->mutex);
+        free(queue);
+
+        return NULL;
+    }
+
+    return queue;
+}
+
+task_queue_t* queue_create_budgeted(size_t capacity, size_t high_watermark, size_t low_watermark) {
+    task_queue_t* queue = queue_create(capacity);
+    if (!queue) return NULL;
+
+    queue_set_watermarks(queue, high_watermark, low_watermark);
 
     return queue;
 }
 
+void queue_set_watermarks(task_queue_t* queue, size_t high_watermark, size_t low_watermark) {
+    pthread_mutex_lock(&queue->mutex);
+
+    queue->high_watermark = high_watermark;
+    queue->low_watermark = MIN(low_watermark, high_watermark);
+    queue->draining = FALSE;
+
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Once the high watermark is crossed producers stay blocked until the queue drains to the low one, and
+// even then a task only gets in if it keeps the queue under the high one. An empty queue always accepts
+// a task so a single file larger than the budget cannot stall the producer; the peak is therefore
+// bounded by the larger of the high watermark and the largest file.
+static int over_budget(task_queue_t* queue, size_t incoming_bytes) {
+    if (!queue->high_watermark || queue->bytes == 0) {
+        queue->draining = FALSE;
+        return FALSE;
+    }
+
+    if (queue->draining) {
+        if (queue->bytes > queue->low_watermark) return TRUE;
+        queue->draining = FALSE;
+    }
+
+    if (queue->bytes + incoming_bytes > queue->high_watermark) {
+        queue->draining = TRUE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// Bytes a task holds against the budget: only copies move data, a hardlink to an already copied inode does not.
+static size_t queued_bytes(const copy_task_t* task) {
+    return task->kind == TASK_HARDLINK ? 0 : task->file_size;
+}
+
+static void account_push(task_queue_t* queue, size_t pushed_bytes) {
+    queue->bytes += pushed_bytes;
+    if (queue->bytes > queue->peak_bytes) queue->peak_bytes = queue->bytes;
+
+    if (queue->prefetch_budget) pthread_cond_signal(&queue->prefetch_wake);
+}
+
+void queue_set_prefetch(task_queue_t* queue, size_t budget, size_t file_bytes) {
+    pthread_mutex_lock(&queue->mutex);
+
+    queue->prefetch_budget = budget;
+    queue->prefetch_file_bytes = MIN(file_bytes, budget);
+
+    pthread_cond_signal(&queue->prefetch_wake);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Bytes the prefetcher reads ahead for a task; only file copies are worth warming.
+size_t queue_prefetch_charge(const task_queue_t* queue, const copy_task_t* task) {
+    if (task->kind != TASK_COPY && task->kind != TASK_REFRESH) return 0;
+    return MIN(task->file_size, queue->prefetch_file_bytes);
+}
+
+static void account_pop(task_queue_t* queue, const copy_task_t* tasks, int count) {
+    queue->popped += count;
+    if (!queue->prefetch_budget) return;
+
+    for (int i = 0; i < count; ++i) queue->popped_prefetch_bytes += queue_prefetch_charge(queue, &tasks[i]);
+    pthread_cond_signal(&queue->prefetch_wake);
+}
+
 int queue_destroy(task_queue_t* queue) {
     if (!queue) return 0;
 
@@ -75,6 +180,12 @@ int queue_destroy(task_queue_t* queue) {
         return -1;
     }
 
+    errCode = pthread_cond_destroy(&queue->prefetch_wake);
+    if (errCode != 0) {
+        fprintf(stderr, RED "Cannot destroy the condition \"prefetch_wake\" in task_queue_t, code: \"%d\"\n" RESET, errCode);
+        return -1;
+    }
+
     errCode = pthread_mutex_destroy(&queue->mutex);
     if (errCode != 0) {
         fprintf(stderr, RED "Cannot destroy the mutex in task_queue_t, code: \"%d\"\n" RESET, errCode);
@@ -88,41 +199,60 @@ int queue_destroy(task_queue_t* queue) {
 void queue_enqueue(task_queue_t* queue, copy_task_t task) {
     pthread_mutex_lock(&queue->mutex);
 
-    while (queue->size == queue->capacity) {
+    double wait_start = 0;
+    while (queue->size == queue->capacity || over_budget(queue, queued_bytes(&task))) {
+        if (trace_enabled && wait_start == 0) wait_start = monotonic_seconds();
         pthread_cond_wait(&queue->not_full, &queue->mutex);
     }
+    if (wait_start != 0) trace_record(TRACE_WAIT_NOT_FULL, wait_start, 0);
 
     queue->tasks[queue->tail] = task;
     queue->tail = (queue->tail + 1) % queue->capacity;
     ++queue->size;
+    account_push(queue, queued_bytes(&task));
 
     pthread_cond_signal(&queue->not_empty);
     pthread_mutex_unlock(&queue->mutex);
 }
 
+// A batch is admitted piece by piece: whenever there is room for its next task, it takes as many of
+// the remaining ones as capacity and byte budget allow. A batch larger than the queue therefore cannot
+// wait forever, and an empty queue takes one task of any size but never a whole oversized batch.
 void queue_enqueue_batch(task_queue_t* queue, copy_task_t* tasks_batch, int batch_count) {
     pthread_mutex_lock(&queue->mutex);
 
-    while (queue->capacity - queue->size < batch_count) {
-        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    int pushed = 0;
+    double wait_start = 0;
+    while (pushed < batch_count) {
+        while (queue->size == queue->capacity || over_budget(queue, queued_bytes(&tasks_batch[pushed]))) {
+            if (trace_enabled && wait_start == 0) wait_start = monotonic_seconds();
+            pthread_cond_wait(&queue->not_full, &queue->mutex);
+        }
+
+        do {
+            queue->tasks[queue->tail] = tasks_batch[pushed];
+            queue->tail = (queue->tail + 1) % queue->capacity;
+            ++queue->size;
+            account_push(queue, queued_bytes(&tasks_batch[pushed]));
+            ++pushed;
+        } while (pushed < batch_count && queue->size < queue->capacity && !over_budget(queue, queued_bytes(&tasks_batch[pushed])));
+
+        pthread_cond_broadcast(&queue->not_empty);
     }
+    if (wait_start != 0) trace_record(TRACE_WAIT_NOT_FULL, wait_start, 0);
 
-    for (int i = 0; i < batch_count; ++i) {
-        queue->tasks[queue->tail] = tasks_batch[i];
-        queue->tail = (queue->tail + 1) % queue->capacity;
-        ++queue->size;
-    }
-    
-    pthread_cond_broadcast(&queue->not_empty);
     pthread_mutex_unlock(&queue->mutex);
 }
 
 int queue_pop(task_queue_t* queue, copy_task_t* out_task) {
     pthread_mutex_lock(&queue->mutex);
 
+    double wait_start = 0;
     while (queue->size == 0 && !queue->shutdown) {
+        if (trace_enabled && wait_start == 0) wait_start = monotonic_seconds();
         pthread_cond_wait(&queue->not_empty, &queue->mutex);
     }
+    if (wait_start != 0) trace_record(TRACE_WAIT_NOT_EMPTY, wait_start, 0);
 
     if (queue->shutdown && queue->size == 0) {
         pthread_mutex_unlock(&queue->mutex);
@@ -132,6 +262,8 @@ int queue_pop(task_queue_t* queue, copy_task_t* out_task) {
     *out_task = queue->tasks[queue->head];
     queue->head = (queue->head + 1) % queue->capacity;
     --queue->size;
+    queue->bytes -= queued_bytes(out_task);
+    account_pop(queue, out_task, 1);
 
     pthread_cond_signal(&queue->not_full);
     pthread_mutex_unlock(&queue->mutex);
@@ -142,9 +274,12 @@ int queue_pop(task_queue_t* queue, copy_task_t* out_task) {
 int queue_pop_batch(task_queue_t* queue, copy_task_t* out_tasks_batch, int max_batch_count) {
     pthread_mutex_lock(&queue->mutex);
 
+    double wait_start = 0;
     while (queue->size == 0 && !queue->shutdown) {
+        if (trace_enabled && wait_start == 0) wait_start = monotonic_seconds();
         pthread_cond_wait(&queue->not_empty, &queue->mutex);
     }
+    if (wait_start != 0) trace_record(TRACE_WAIT_NOT_EMPTY, wait_start, 0);
 
     if (queue->shutdown && queue->size == 0) {
         pthread_mutex_unlock(&queue->mutex);
@@ -152,13 +287,23 @@ int queue_pop_batch(task_queue_t* queue, copy_task_t* out_tasks_batch, int max_b
     }
 
     int pop_count = (queue->size < max_batch_count) ? queue->size : max_batch_count;
+    size_t popped_bytes = 0;
 
     for (int i = 0; i < pop_count; ++i) {
+        // With a byte budget a worker takes at most pop_bytes at once, so large files spread across workers.
+        if (queue->pop_bytes && i > 0 && popped_bytes + queued_bytes(&queue->tasks[queue->head]) > queue->pop_bytes) {
+            pop_count = i;
+            break;
+        }
+
         out_tasks_batch[i] = queue->tasks[queue->head];
         queue->head = (queue->head + 1) % queue->capacity;
+        popped_bytes += queued_bytes(&out_tasks_batch[i]);
     }
 
     queue->size -= pop_count;
+    queue->bytes -= popped_bytes;
+    account_pop(queue, out_tasks_batch, pop_count);
 
     pthread_cond_broadcast(&queue->not_full);
     pthread_mutex_unlock(&queue->mutex);
@@ -17,11 +17,37 @@ typedef struct task_queue_t {
     pthread_cond_t not_empty;
     pthread_cond_t not_full;
     int shutdown;
+
+    // Byte budget; high_watermark == 0 keeps the queue bounded by task count only.
+    size_t bytes;
+    size_t peak_bytes;
+    size_t high_watermark;
+    size_t low_watermark;
+    size_t pop_bytes;
+    int draining;
+
+    // Readahead look-ahead, prefetch_budget == 0 disables it. Positions are absolute task indices and
+    // cumulative readahead bytes, so the prefetcher's lead over the workers is a plain subtraction.
+    size_t popped;
+    size_t popped_prefetch_bytes;
+    size_t prefetch_next;
+    size_t prefetch_next_bytes;
+    size_t prefetch_budget;
+    size_t prefetch_file_bytes;
+    pthread_cond_t prefetch_wake;
+
+    size_t prefetched_files;
+    size_t prefetched_bytes;
 } task_queue_t;
 
 task_queue_t* queue_create(size_t capacity);
+task_queue_t* queue_create_budgeted(size_t capacity, size_t high_watermark, size_t low_watermark);
+void queue_set_watermarks(task_queue_t* queue, size_t high_watermark, size_t low_watermark);
 int queue_destroy(task_queue_t* queue);
 
+void queue_set_prefetch(task_queue_t* queue, size_t budget, size_t file_bytes);
+size_t queue_prefetch_charge(const task_queue_t* queue, const copy_task_t* task);
+
 void queue_enqueue(task_queue_t* queue, copy_task_t task);
 void queue_enqueue_batch(task_queue_t* queue, copy_task_t* tasks_batch, int batch_count);
 int queue_pop(task_queue_t* queue, copy_task_t* out_task);
@@ -0,0 +1,159 @@
+#include "throttle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+volatile int throttle_enabled = FALSE;
+
+static throttle_t throttle;
+
+static void sleep_seconds(double seconds) {
+#ifdef _WIN32
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    struct timespec delay;
+    delay.tv_sec = (time_t)seconds;
+    delay.tv_nsec = (long)((seconds - (double)delay.tv_sec) * 1e9);
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {}
+#endif
+}
+
+static int bucket_init(token_bucket_t* bucket, double rate) {
+    memset(bucket, 0, sizeof(*bucket));
+    bucket->limited = rate > 0;
+    bucket->rate = rate;
+    bucket->capacity = MAX(rate * THROTTLE_BURST_SECONDS, 1.0);
+    bucket->tokens = bucket->capacity;
+    bucket->last = monotonic_seconds();
+
+    if (pthread_mutex_init(&bucket->mutex, NULL) != 0) {
+        fprintf(stderr, RED "Cannot create mutex in token_bucket_t\n" RESET);
+        return -1;
+    }
+    return 0;
+}
+
+static void bucket_refill(token_bucket_t* bucket, double now) {
+    bucket->tokens = MIN(bucket->capacity, bucket->tokens + (now - bucket->last) * bucket->rate);
+    bucket->last = now;
+}
+
+static void bucket_acquire(token_bucket_t* bucket, double amount) {
+    if (!bucket->limited) return;
+
+    pthread_mutex_lock(&bucket->mutex);
+    bucket_refill(bucket, monotonic_seconds());
+    bucket->tokens -= amount;
+
+    double wait = bucket->tokens < 0 ? -bucket->tokens / bucket->rate : 0;
+    if (wait > 0) {
+        bucket->waited += wait;
+        ++bucket->waits;
+    }
+    pthread_mutex_unlock(&bucket->mutex);
+
+    if (wait > 0) sleep_seconds(wait);
+}
+
+int throttle_start(double read_rate, double write_rate, double open_rate, int slow_start) {
+    memset(&throttle, 0, sizeof(throttle));
+
+    throttle.slow_start = slow_start;
+    throttle.ceiling = write_rate;
+    if (slow_start) write_rate = write_rate > 0 ? MIN(write_rate, SLOW_START_INITIAL) : SLOW_START_INITIAL;
+
+    if (bucket_init(&throttle.read, read_rate) != 0) return -1;
+    if (bucket_init(&throttle.write, write_rate) != 0) return -1;
+    if (bucket_init(&throttle.open, open_rate) != 0) return -1;
+
+    throttle.interval_start = monotonic_seconds();
+    throttle_enabled = read_rate > 0 || write_rate > 0 || open_rate > 0;
+    return 0;
+}
+
+void throttle_read(size_t bytes) {
+    bucket_acquire(&throttle.read, (double)bytes);
+}
+
+void throttle_write(size_t bytes) {
+    bucket_acquire(&throttle.write, (double)bytes);
+}
+
+void throttle_open(void) {
+    bucket_acquire(&throttle.open, 1.0);
+}
+
+void throttle_write_done(size_t bytes, double seconds) {
+    if (!throttle.slow_start) return;
+
+    token_bucket_t* bucket = &throttle.write;
+    pthread_mutex_lock(&bucket->mutex);
+
+    throttle.interval_bytes += (double)bytes;
+    throttle.interval_seconds += seconds;
+
+    double now = monotonic_seconds();
+    if (now - throttle.interval_start >= SLOW_START_INTERVAL && throttle.interval_bytes > 0) {
+        double per_mb = throttle.interval_seconds / throttle.interval_bytes * MEGA_BYTE;
+
+        // The best latency seen is the reference; it creeps up slowly so one lucky interval does not pin it.
+        if (throttle.baseline == 0 || per_mb < throttle.baseline) throttle.baseline = per_mb;
+        else throttle.baseline += (per_mb - throttle.baseline) * 0.01;
+
+        bucket_refill(bucket, now);
+        if (per_mb > throttle.baseline * SLOW_START_LATENCY_FACTOR) {
+            bucket->rate = MAX(bucket->rate / 2, SLOW_START_MIN);
+            ++throttle.backoffs;
+        } else {
+            bucket->rate += SLOW_START_STEP;
+            if (throttle.ceiling > 0) bucket->rate = MIN(bucket->rate, throttle.ceiling);
+        }
+        bucket->capacity = MAX(bucket->rate * THROTTLE_BURST_SECONDS, 1.0);
+
+        throttle.interval_start = now;
+        throttle.interval_bytes = 0;
+        throttle.interval_seconds = 0;
+    }
+
+    pthread_mutex_unlock(&bucket->mutex);
+}
+
+size_t throttle_chunk(size_t size) {
+    return throttle_enabled ? MIN(size, THROTTLE_CHUNK) : size;
+}
+
+static void report_bucket(const char* name, const token_bucket_t* bucket, const char* unit, double scale) {
+    if (!bucket->limited) return;
+    printf(
+        CYN "Throttle %-5s: %.1f %s, workers slept %.2f sec in %zu waits\n" RESET,
+        name, bucket->rate / scale, unit, bucket->waited, bucket->waits
+    );
+}
+
+void throttle_report(void) {
+    if (!throttle_enabled) return;
+
+    report_bucket("read", &throttle.read, "MB/s", MEGA_BYTE);
+    report_bucket("write", &throttle.write, "MB/s", MEGA_BYTE);
+    report_bucket("open", &throttle.open, "files/s", 1.0);
+
+    if (throttle.slow_start) {
+        printf(
+            CYN "Slow start: write rate ended at %.1f MB/s after %zu backoffs (best latency %.2f ms/MB)\n" RESET,
+            throttle.write.rate / MEGA_BYTE, throttle.backoffs, throttle.baseline * 1000.0
+        );
+    }
+}
+
+void throttle_finish(void) {
+    throttle_enabled = FALSE;
+    pthread_mutex_destroy(&throttle.read.mutex);
+    pthread_mutex_destroy(&throttle.write.mutex);
+    pthread_mutex_destroy(&throttle.open.mutex);
+}
\ No newline at end of file
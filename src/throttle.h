@@ -0,0 +1,74 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include "core.h"
+
+#define THROTTLE_BURST_SECONDS 0.25
+#define THROTTLE_CHUNK ((size_t)1 * MEGA_BYTE)
+
+#define SLOW_START_INITIAL ((double)8 * MEGA_BYTE)
+#define SLOW_START_STEP ((double)4 * MEGA_BYTE)
+#define SLOW_START_MIN ((double)1 * MEGA_BYTE)
+#define SLOW_START_INTERVAL 0.25
+#define SLOW_START_LATENCY_FACTOR 2.0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Tokens refill at rate per second up to a burst of THROTTLE_BURST_SECONDS. A caller takes what it
+// needs even past zero and sleeps off its own debt, so one large chunk cannot starve the others.
+typedef struct token_bucket_t {
+    pthread_mutex_t mutex;
+    // Set once at init; rate itself may change under the mutex (slow start) and is only read there.
+    int limited;
+    double rate;
+    double capacity;
+    double tokens;
+    double last;
+
+    double waited;
+    size_t waits;
+} token_bucket_t;
+
+// Shared by every worker. Slow start drives the write rate with AIMD: it grows by SLOW_START_STEP each
+// interval while write latency per MB stays near the best seen, and halves once it exceeds
+// SLOW_START_LATENCY_FACTOR times that; --write-limit, if any, stays the ceiling.
+typedef struct throttle_t {
+    token_bucket_t read;
+    token_bucket_t write;
+    token_bucket_t open;
+
+    int slow_start;
+    double ceiling;
+    double interval_start;
+    double interval_seconds;
+    double interval_bytes;
+    double baseline;
+    size_t backoffs;
+} throttle_t;
+
+// Checked before every call into the buckets, so an unthrottled run pays one load per chunk.
+extern volatile int throttle_enabled;
+
+// Rates of 0 mean unlimited. Must run before the workers start.
+int throttle_start(double read_rate, double write_rate, double open_rate, int slow_start);
+
+void throttle_read(size_t bytes);
+void throttle_write(size_t bytes);
+void throttle_open(void);
+
+// Completed write of bytes that took seconds; feeds slow start.
+void throttle_write_done(size_t bytes, double seconds);
+
+// Chunk size for the copy loops: small enough that a throttled copy trickles instead of bursting.
+size_t throttle_chunk(size_t size);
+
+void throttle_report(void);
+void throttle_finish(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL _Thread_local
+#endif
+
+volatile int trace_enabled = FALSE;
+
+static TRACE_THREAD_LOCAL trace_buffer_t* thread_buffer = NULL;
+
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer_t* buffers = NULL;
+static int buffers_count = 0;
+static double trace_base = 0;
+
+static const char* kind_names[TRACE_KINDS] = {
+    "scan_dir", "wait_not_empty", "wait_not_full", "open", "copy", "close", "file"
+};
+
+static const size_t class_bounds[TRACE_SIZE_CLASSES - 1] = {
+    4 * KILO_BYTE, 64 * KILO_BYTE, MEGA_BYTE, 16 * MEGA_BYTE
+};
+
+static const char* class_names[TRACE_SIZE_CLASSES] = {
+    "< 4K", "< 64K", "< 1M", "< 16M", ">= 16M"
+};
+
+static const double latency_bounds[TRACE_LATENCY_BUCKETS - 1] = {
+    100e-6, 1e-3, 10e-3, 100e-3, 1.0
+};
+
+static const char* latency_names[TRACE_LATENCY_BUCKETS] = {
+    "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"
+};
+
+void trace_start(void) {
+    trace_base = monotonic_seconds();
+    trace_enabled = TRUE;
+}
+
+// Registration is the only locked step and happens once per thread, on its first event.
+static trace_buffer_t* current_buffer(void) {
+    if (thread_buffer) return thread_buffer;
+
+    trace_buffer_t* buffer = calloc(1, sizeof(trace_buffer_t));
+    if (!buffer) return NULL;
+
+    buffer->events = malloc(TRACE_RING_SIZE * sizeof(trace_event_t));
+    if (!buffer->events) {
+        free(buffer);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&buffers_mutex);
+    buffer->tid = buffers_count++;
+    buffer->next_buffer = buffers;
+    buffers = buffer;
+    pthread_mutex_unlock(&buffers_mutex);
+
+    snprintf(buffer->name, sizeof(buffer->name), "thread %d", buffer->tid);
+    thread_buffer = buffer;
+
+    return buffer;
+}
+
+void trace_thread_name(const char* role, int id) {
+    if (!trace_enabled) return;
+
+    trace_buffer_t* buffer = current_buffer();
+    if (buffer) snprintf(buffer->name, sizeof(buffer->name), "%s #%d", role, id);
+}
+
+static int size_class(size_t size) {
+    int i = 0;
+    while (i < TRACE_SIZE_CLASSES - 1 && size >= class_bounds[i]) ++i;
+    return i;
+}
+
+static int latency_bucket(double seconds) {
+    int i = 0;
+    while (i < TRACE_LATENCY_BUCKETS - 1 && seconds >= latency_bounds[i]) ++i;
+    return i;
+}
+
+void trace_record(trace_kind_t kind, double start, size_t bytes) {
+    double end = monotonic_seconds();
+
+    trace_buffer_t* buffer = current_buffer();
+    if (!buffer) return;
+
+    trace_event_t* event = &buffer->events[buffer->next % TRACE_RING_SIZE];
+    event->start = start;
+    event->end = end;
+    event->bytes = bytes;
+    event->kind = kind;
+    ++buffer->next;
+
+    buffer->kind_time[kind] += end - start;
+    ++buffer->kind_count[kind];
+
+    if (kind == TRACE_FILE) {
+        int cls = size_class(bytes);
+        ++buffer->latency[cls][latency_bucket(end - start)];
+        if (end - start > buffer->latency_max[cls]) buffer->latency_max[cls] = end - start;
+    }
+}
+
+int trace_dump(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, RED "Cannot create trace file \"%s\": %s\n" RESET, path, strerror(errno));
+        return -1;
+    }
+
+    // Chrome trace-event format: complete ("X") events with microsecond timestamps, one tid per thread.
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    int first = TRUE;
+    for (trace_buffer_t* buffer = buffers; buffer; buffer = buffer->next_buffer) {
+        fprintf(
+            f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", buffer->tid, buffer->name
+        );
+        first = FALSE;
+
+        size_t begin = buffer->next > TRACE_RING_SIZE ? buffer->next - TRACE_RING_SIZE : 0;
+        for (size_t i = begin; i < buffer->next; ++i) {
+            const trace_event_t* event = &buffer->events[i % TRACE_RING_SIZE];
+            fprintf(
+                f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%zu}}",
+                kind_names[event->kind], buffer->tid, (event->start - trace_base) * 1e6, (event->end - event->start) * 1e6, event->bytes
+            );
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, RED "Cannot write trace file \"%s\": %s\n" RESET, path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void trace_report(void) {
+    double kind_time[TRACE_KINDS] = {0};
+    size_t kind_count[TRACE_KINDS] = {0};
+    size_t latency[TRACE_SIZE_CLASSES][TRACE_LATENCY_BUCKETS] = {{0}};
+    double latency_max[TRACE_SIZE_CLASSES] = {0};
+    size_t dropped = 0;
+
+    for (trace_buffer_t* buffer = buffers; buffer; buffer = buffer->next_buffer) {
+        for (int k = 0; k < TRACE_KINDS; ++k) {
+            kind_time[k] += buffer->kind_time[k];
+            kind_count[k] += buffer->kind_count[k];
+        }
+        for (int c = 0; c < TRACE_SIZE_CLASSES; ++c) {
+            for (int b = 0; b < TRACE_LATENCY_BUCKETS; ++b) latency[c][b] += buffer->latency[c][b];
+            latency_max[c] = MAX(latency_max[c], buffer->latency_max[c]);
+        }
+        if (buffer->next > TRACE_RING_SIZE) dropped += buffer->next - TRACE_RING_SIZE;
+    }
+
+    printf(
+        BLU "\nQueue waits: not_empty %.3f sec (%zu waits), not_full %.3f sec (%zu waits)\n" RESET,
+        kind_time[TRACE_WAIT_NOT_EMPTY], kind_count[TRACE_WAIT_NOT_EMPTY],
+        kind_time[TRACE_WAIT_NOT_FULL], kind_count[TRACE_WAIT_NOT_FULL]
+    );
+    printf(
+        BLU "Time in spans: scan %.3f sec, open %.3f sec, copy %.3f sec, close %.3f sec\n" RESET,
+        kind_time[TRACE_SCAN_DIR], kind_time[TRACE_OPEN], kind_time[TRACE_COPY], kind_time[TRACE_CLOSE]
+    );
+
+    printf(BLU "Per-file latency:\n" WEAK "  %-7s", "size");
+    for (int b = 0; b < TRACE_LATENCY_BUCKETS; ++b) printf(" %9s", latency_names[b]);
+    printf(" %10s\n" RESET, "max");
+
+    for (int c = 0; c < TRACE_SIZE_CLASSES; ++c) {
+        printf(WEAK "  %-7s", class_names[c]);
+        for (int b = 0; b < TRACE_LATENCY_BUCKETS; ++b) printf(" %9zu", latency[c][b]);
+        printf(" %8.3fms\n" RESET, latency_max[c] * 1e3);
+    }
+
+    if (dropped) printf(YEL "Trace rings wrapped: %zu oldest events are not in the trace file\n" RESET, dropped);
+}
+
+void trace_finish(void) {
+    trace_enabled = FALSE;
+
+    pthread_mutex_lock(&buffers_mutex);
+    while (buffers) {
+        trace_buffer_t* buffer = buffers;
+        buffers = buffer->next_buffer;
+
+        free(buffer->events);
+        free(buffer);
+    }
+    buffers_count = 0;
+    pthread_mutex_unlock(&buffers_mutex);
+
+    thread_buffer = NULL;
+}
\ No newline at end of file
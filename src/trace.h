@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "core.h"
+
+#define TRACE_RING_SIZE ((size_t)1 << 16)
+#define TRACE_SIZE_CLASSES 5
+#define TRACE_LATENCY_BUCKETS 6
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum trace_kind_t {
+    TRACE_SCAN_DIR = 0,
+    TRACE_WAIT_NOT_EMPTY,
+    TRACE_WAIT_NOT_FULL,
+    TRACE_OPEN,
+    TRACE_COPY,
+    TRACE_CLOSE,
+    TRACE_FILE,
+    TRACE_KINDS
+} trace_kind_t;
+
+typedef struct trace_event_t {
+    double start;
+    double end;
+    size_t bytes;
+    trace_kind_t kind;
+} trace_event_t;
+
+// One ring per thread, written only by its owner and read once every thread has been joined,
+// so recording needs no locks. When the ring wraps the oldest events are overwritten; the
+// aggregates below keep counting regardless.
+typedef struct trace_buffer_t {
+    char name[32];
+    int tid;
+    size_t next;
+    trace_event_t* events;
+
+    double kind_time[TRACE_KINDS];
+    size_t kind_count[TRACE_KINDS];
+    size_t latency[TRACE_SIZE_CLASSES][TRACE_LATENCY_BUCKETS];
+    double latency_max[TRACE_SIZE_CLASSES];
+
+    struct trace_buffer_t* next_buffer;
+} trace_buffer_t;
+
+// Checked before every timestamp is taken, so a run without --trace pays one load per span.
+extern volatile int trace_enabled;
+
+#define TRACE_BEGIN() (trace_enabled ? monotonic_seconds() : 0.0)
+#define TRACE_END(kind, start, bytes) do { if (trace_enabled) trace_record((kind), (start), (bytes)); } while (0)
+
+void trace_start(void);
+void trace_thread_name(const char* role, int id);
+void trace_record(trace_kind_t kind, double start, size_t bytes);
+
+// Must run after every traced thread has been joined.
+int trace_dump(const char* path);
+void trace_report(void);
+void trace_finish(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,403 @@
+#include "verify.h"
+#include "taskQueue.h"
+#include "devicePools.h"
+#include "options.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+
+void* verifier_thread(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+int verify_main(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    fprintf(stderr, RED "verify is not supported on Windows\n" RESET);
+    return 2;
+}
+
+#else //POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+typedef enum compare_result_t {
+    COMPARE_SAME = 0,
+    COMPARE_DIFFERENT,
+    COMPARE_FAILED
+} compare_result_t;
+
+static void json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)s; *p; ++p) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p < 0x20) fprintf(out, "\\u%04x", *p);
+        else fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+static void report(verify_t* verify, const char* status, const char* rel, const char* detail, size_t* counter) {
+    pthread_mutex_lock(&verify->mutex);
+    ++*counter;
+
+    if (verify->json) {
+        fprintf(verify->out, "{\"status\":\"%s\",\"path\":", status);
+        json_string(verify->out, rel);
+        if (detail) {
+            fputs(",\"detail\":", verify->out);
+            json_string(verify->out, detail);
+        }
+        fputs("}\n", verify->out);
+    } else {
+        fprintf(verify->out, "%s\t%s%s%s\n", status, rel, detail ? "\t" : "", detail ? detail : "");
+    }
+
+    pthread_mutex_unlock(&verify->mutex);
+}
+
+// Compares both files window by window through read-only mappings; memcmp does the vectorized work.
+// A file truncated while it is mapped faults, as it would for any mmap reader.
+static compare_result_t compare_contents(const char* src, const char* dest, size_t size, size_t* compared, unsigned long long* at, int* err) {
+    compare_result_t result = COMPARE_SAME;
+    int src_fd = open(src, O_RDONLY);
+    int dest_fd = open(dest, O_RDONLY);
+
+    if (src_fd == -1 || dest_fd == -1) {
+        *err = errno;
+        result = COMPARE_FAILED;
+        goto cleanup;
+    }
+
+    for (size_t offset = 0; offset < size && result == COMPARE_SAME; offset += VERIFY_WINDOW) {
+        size_t len = MIN(size - offset, VERIFY_WINDOW);
+        char* a = mmap(NULL, len, PROT_READ, MAP_SHARED, src_fd, (off_t)offset);
+        char* b = a == MAP_FAILED ? MAP_FAILED : mmap(NULL, len, PROT_READ, MAP_SHARED, dest_fd, (off_t)offset);
+
+        if (a == MAP_FAILED || b == MAP_FAILED) {
+            *err = errno;
+            if (a != MAP_FAILED) munmap(a, len);
+            result = COMPARE_FAILED;
+            break;
+        }
+        madvise(a, len, MADV_SEQUENTIAL);
+        madvise(b, len, MADV_SEQUENTIAL);
+
+        for (size_t pos = 0; pos < len; pos += VERIFY_CHUNK) {
+            size_t chunk = MIN(len - pos, VERIFY_CHUNK);
+            if (memcmp(a + pos, b + pos, chunk) != 0) {
+                size_t i = 0;
+                while (a[pos + i] == b[pos + i]) ++i;
+
+                *at = offset + pos + i;
+                result = COMPARE_DIFFERENT;
+                break;
+            }
+            *compared += chunk;
+        }
+
+        munmap(a, len);
+        munmap(b, len);
+    }
+
+cleanup:
+    if (src_fd != -1) close(src_fd);
+    if (dest_fd != -1) close(dest_fd);
+    return result;
+}
+
+static void verify_entry(verify_t* verify, const copy_task_t* task, worker_stats_t* thread_stat) {
+    const char* rel = task->source_path + verify->src_root_len;
+    while (*rel == '/') ++rel;
+
+    char detail[128];
+    struct stat src_st, dest_st;
+    ++thread_stat->total_files;
+
+    if (lstat(task->source_path, &src_st) != 0) {
+        snprintf(detail, sizeof(detail), "source: %s", strerror(errno));
+        report(verify, "ERROR", rel, detail, &verify->errors);
+        return;
+    }
+    if (lstat(task->dest_path, &dest_st) != 0) {
+        int err = errno;
+        if (err == ENOENT) {
+            report(verify, "MISSING", rel, NULL, &verify->missing);
+        } else {
+            snprintf(detail, sizeof(detail), "destination: %s", strerror(err));
+            report(verify, "ERROR", rel, detail, &verify->errors);
+        }
+        return;
+    }
+
+    // Cheap checks first: most differences show up without reading any data.
+    if ((src_st.st_mode & S_IFMT) != (dest_st.st_mode & S_IFMT)) {
+        report(verify, "DIFFER", rel, "type", &verify->differ);
+        return;
+    }
+    if (S_ISREG(src_st.st_mode) && src_st.st_size != dest_st.st_size) {
+        snprintf(detail, sizeof(detail), "size %lld != %lld", (long long)src_st.st_size, (long long)dest_st.st_size);
+        report(verify, "DIFFER", rel, detail, &verify->differ);
+        return;
+    }
+    // Directories are created 0755 so the workers can always fill them, their metadata is not compared.
+    if (verify->metadata && !S_ISLNK(src_st.st_mode) && !S_ISDIR(src_st.st_mode)) {
+        if ((src_st.st_mode & 07777) != (dest_st.st_mode & 07777)) {
+            snprintf(detail, sizeof(detail), "mode %o != %o", (unsigned)(src_st.st_mode & 07777), (unsigned)(dest_st.st_mode & 07777));
+            report(verify, "DIFFER", rel, detail, &verify->differ);
+            return;
+        }
+        if (src_st.st_mtime != dest_st.st_mtime) {
+            snprintf(detail, sizeof(detail), "mtime %lld != %lld", (long long)src_st.st_mtime, (long long)dest_st.st_mtime);
+            report(verify, "DIFFER", rel, detail, &verify->differ);
+            return;
+        }
+    }
+
+    if (S_ISLNK(src_st.st_mode)) {
+        char src_target[MAX_PATH];
+        char dest_target[MAX_PATH];
+        ssize_t src_len = readlink(task->source_path, src_target, sizeof(src_target));
+        ssize_t dest_len = readlink(task->dest_path, dest_target, sizeof(dest_target));
+
+        if (src_len < 0 || dest_len < 0) {
+            snprintf(detail, sizeof(detail), "readlink: %s", strerror(errno));
+            report(verify, "ERROR", rel, detail, &verify->errors);
+        } else if ((size_t)src_len >= sizeof(src_target) || (size_t)dest_len >= sizeof(dest_target)) {
+            report(verify, "ERROR", rel, "readlink: target too long", &verify->errors);
+        } else if (src_len != dest_len || memcmp(src_target, dest_target, (size_t)src_len) != 0) {
+            report(verify, "DIFFER", rel, "target", &verify->differ);
+        }
+        return;
+    }
+    if (!S_ISREG(src_st.st_mode)) return;
+
+    size_t compared = 0;
+    unsigned long long at = 0;
+    int err = 0;
+
+    switch (compare_contents(task->source_path, task->dest_path, (size_t)src_st.st_size, &compared, &at, &err)) {
+    case COMPARE_DIFFERENT:
+        snprintf(detail, sizeof(detail), "content at %llu", at);
+        report(verify, "DIFFER", rel, detail, &verify->differ);
+        break;
+    case COMPARE_FAILED:
+        snprintf(detail, sizeof(detail), "compare: %s", strerror(err));
+        report(verify, "ERROR", rel, detail, &verify->errors);
+        break;
+    default:
+        break;
+    }
+    thread_stat->total_bytes += compared;
+}
+
+void* verifier_thread(void* arg) {
+    thread_context_t* cont = (thread_context_t*)arg;
+    copy_task_t current_tasks_batch[WORKER_BATCH_SIZE];
+
+    trace_thread_name("verifier", cont->id);
+
+    for (;;) {
+        int batch_count = queue_pop_batch(cont->queue, current_tasks_batch, WORKER_BATCH_SIZE);
+        if (batch_count < 0) break;
+
+        for (int i = 0; i < batch_count; ++i) {
+            verify_entry(cont->verify, &current_tasks_batch[i], cont->stats);
+
+            free(current_tasks_batch[i].source_path);
+            free(current_tasks_batch[i].dest_path);
+        }
+    }
+
+    return NULL;
+}
+
+// Destination side: anything without a source counterpart is extra. Type mismatches are left to the
+// verifiers, which see the same pair from the source side.
+static void find_extras(verify_t* verify, const char* dest, const char* src) {
+    size_t dest_root_len = strlen(verify->dest_root);
+    DIR* dir = opendir(dest);
+    if (!dir) {
+        char detail[128];
+        snprintf(detail, sizeof(detail), "opendir: %s", strerror(errno));
+        report(verify, "ERROR", dest + MIN(strlen(dest), dest_root_len + 1), detail, &verify->errors);
+        return;
+    }
+
+    char* dest_path = NULL;
+    char* src_path = NULL;
+    struct dirent* entry;
+
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        size_t dest_len = strlen(dest) + strlen(entry->d_name) + 2;
+        size_t src_len = strlen(src) + strlen(entry->d_name) + 2;
+        char* grown_dest = realloc(dest_path, dest_len);
+        if (grown_dest) dest_path = grown_dest;
+        char* grown_src = realloc(src_path, src_len);
+        if (grown_src) src_path = grown_src;
+        if (!grown_dest || !grown_src) break;
+
+        snprintf(dest_path, dest_len, "%s/%s", dest, entry->d_name);
+        snprintf(src_path, src_len, "%s/%s", src, entry->d_name);
+
+        struct stat dest_st, src_st;
+        if (lstat(dest_path, &dest_st) != 0) continue;
+
+        if (lstat(src_path, &src_st) != 0) {
+            if (errno == ENOENT && (S_ISDIR(dest_st.st_mode) || check_extension(dest_path, verify->filter))) {
+                report(verify, "EXTRA", dest_path + dest_root_len + 1, NULL, &verify->extra);
+            }
+            continue;
+        }
+
+        if (S_ISDIR(dest_st.st_mode) && S_ISDIR(src_st.st_mode)) find_extras(verify, dest_path, src_path);
+    }
+
+    free(dest_path);
+    free(src_path);
+    closedir(dir);
+}
+
+static void* extras_thread(void* arg) {
+    verify_t* verify = (verify_t*)arg;
+    trace_thread_name("extras", 0);
+
+    find_extras(verify, verify->dest_root, verify->src_root);
+    return NULL;
+}
+
+int verify_main(int argc, char* argv[]) {
+    if (argc < 4) {
+        print_usage();
+        return 2;
+    }
+
+    verify_t verify;
+    memset(&verify, 0, sizeof(verify));
+    verify.src_root = argv[1];
+    verify.dest_root = argv[2];
+    verify.filter = argv[3];
+    verify.src_root_len = strlen(verify.src_root);
+
+    const char* output = NULL;
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            verify.json = TRUE;
+        } else if (strcmp(argv[i], "--metadata") == 0) {
+            verify.metadata = TRUE;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            fprintf(stderr, RED "Unknown verify option \"%s\"\n" RESET, argv[i]);
+            print_usage();
+            return 2;
+        }
+    }
+
+    struct stat src_stat, dest_stat;
+    if (stat(verify.src_root, &src_stat) != 0 || !S_ISDIR(src_stat.st_mode)) {
+        fprintf(stderr, RED "verify: \"%s\" is not a directory\n" RESET, verify.src_root);
+        return 2;
+    }
+    if (stat(verify.dest_root, &dest_stat) != 0 || !S_ISDIR(dest_stat.st_mode)) {
+        fprintf(stderr, RED "verify: \"%s\" is not a directory\n" RESET, verify.dest_root);
+        return 2;
+    }
+
+    // The report owns stdout (unless --output is given); everything else printed along the way goes to stderr.
+    if (output) {
+        verify.out = fopen(output, "w");
+    } else {
+        fflush(stdout);
+        int report_fd = dup(STDOUT_FILENO);
+        verify.out = report_fd == -1 ? NULL : fdopen(report_fd, "w");
+        if (verify.out) dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    if (!verify.out) {
+        fprintf(stderr, RED "verify: Cannot open the report output: %s\n" RESET, strerror(errno));
+        return 2;
+    }
+
+    if (pthread_mutex_init(&verify.mutex, NULL) != 0) {
+        fprintf(stderr, RED "Cannot create mutex in verify_t\n" RESET);
+        return 2;
+    }
+
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_workers = nproc < 1 ? 1 : (int)nproc;
+
+    device_pools_t pools;
+    if (device_pools_init(&pools) != 0) return 2;
+    pools.workers_per_pool = num_workers;
+    pools.queue_capacity = BATCH_SIZE * num_workers;
+    pools.worker = verifier_thread;
+    pools.verify = &verify;
+
+    if (!device_pools_route(&pools, (unsigned long long)src_stat.st_dev)) {
+        fprintf(stderr, RED "Critical error: Cannot create worker pool\n" RESET);
+        return 2;
+    }
+
+    double start = monotonic_seconds();
+    size_t entries_checked = 0;
+
+    // Hardlinks are verified path by path, so no inode map: every entry arrives as a plain task.
+    producer_context_t producer;
+    memset(&producer, 0, sizeof(producer));
+    producer.files_counter = &entries_checked;
+    producer.pools = &pools;
+    producer.src_dir = verify.src_root;
+    producer.dest_dir = verify.dest_root;
+    producer.filter = verify.filter;
+
+    pthread_t producer_id, extras_id;
+    if (pthread_create(&producer_id, NULL, producer_thread, &producer) != 0) {
+        fprintf(stderr, RED "Cannot create producer #0\n" RESET);
+        return 2;
+    }
+    int extras_running = pthread_create(&extras_id, NULL, extras_thread, &verify) == 0;
+    if (!extras_running) fprintf(stderr, RED "Cannot create the extras scanner, extra files will not be reported\n" RESET);
+
+    pthread_join(producer_id, NULL);
+    device_pools_join(&pools);
+    if (extras_running) pthread_join(extras_id, NULL);
+
+    double elapsed = monotonic_seconds() - start;
+    size_t total_entries = 0;
+    size_t total_bytes = 0;
+    for (int p = 0; p < pools.count; ++p) {
+        for (int i = 0; i < pools.pools[p].num_workers; ++i) {
+            total_entries += pools.pools[p].contexts[i].stats->total_files;
+            total_bytes += pools.pools[p].contexts[i].stats->total_bytes;
+        }
+    }
+
+    fclose(verify.out);
+
+    int clean = verify.missing == 0 && verify.extra == 0 && verify.differ == 0 && verify.errors == 0;
+    printf(
+        "%s\nVerified \"%s\" against \"%s\".\n"
+        YEL "Entries verified: %zu, content compared: %zu bytes (%.1f MB/s)\n"
+        CYN "Missing: %zu, extra: %zu, differing: %zu, errors: %zu\n"
+        PRP "Total time: %.2f sec\n"
+        RESET, clean ? GRN : RED, verify.src_root, verify.dest_root, total_entries, total_bytes,
+        elapsed > 0 ? (double)total_bytes / MEGA_BYTE / elapsed : 0.0,
+        verify.missing, verify.extra, verify.differ, verify.errors, elapsed
+    );
+
+    device_pools_destroy(&pools);
+    pthread_mutex_destroy(&verify.mutex);
+
+    return clean ? 0 : 1;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "core.h"
+
+#define VERIFY_WINDOW ((size_t)256 * MEGA_BYTE)
+#define VERIFY_CHUNK ((size_t)8 * MEGA_BYTE)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// "verify <source_dir> <destination_dir> <extension_filter>": the scanner feeds the source tree to a pool
+// of verifiers, which check each destination entry cheaply (type, size, optionally mode and mtime)
+// and only then compare contents through mmap windows of both files. A second thread walks the
+// destination for entries the source does not have. Findings are reported one per line:
+//   MISSING <path> / EXTRA <path> / DIFFER <path> <detail> / ERROR <path> <detail>
+// tab-separated, or as JSON lines with --json.
+typedef struct verify_t {
+    const char* src_root;
+    const char* dest_root;
+    const char* filter;
+    size_t src_root_len;
+    int json;
+    int metadata;
+
+    pthread_mutex_t mutex;
+    FILE* out;
+
+    size_t files;
+    size_t bytes;
+    size_t missing;
+    size_t extra;
+    size_t differ;
+    size_t errors;
+} verify_t;
+
+void* verifier_thread(void* arg);
+
+// Entry point of the subcommand; argv[0] is "verify". Returns the process exit code:
+// 0 when the trees match, 1 when anything differs or could not be checked, 2 on usage or setup errors.
+int verify_main(int argc, char* argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,483 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "watch.h"
+#include "devicePools.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef __linux__
+
+int watch_init(watch_t* watch, const char* src_root, const char* dest_root, const char* filter, int debounce_ms) {
+    (void)src_root; (void)dest_root; (void)filter; (void)debounce_ms;
+    memset(watch, 0, sizeof(*watch));
+    fprintf(stderr, RED "--watch is only supported on Linux\n" RESET);
+    return -1;
+}
+
+void watch_destroy(watch_t* watch) {
+    (void)watch;
+}
+
+int watch_run(watch_t* watch, device_pools_t* pools) {
+    (void)watch; (void)pools;
+    return 0;
+}
+
+void watch_request_stop(void) {
+}
+
+int refresh_entry(const char* src, char* const* dests, int dest_count, int* errors, worker_stats_t* thread_stat, size_t buff_size, int unique) {
+    (void)src; (void)dests; (void)thread_stat; (void)buff_size; (void)unique;
+    for (int k = 0; k < dest_count; ++k) errors[k] = ENOSYS;
+    return ENOSYS;
+}
+
+#else //Linux
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW | IN_EXCL_UNLINK | IN_ONLYDIR)
+
+static int stop_pipe[2] = { -1, -1 };
+
+typedef struct watch_batch_t {
+    device_pools_t* pools;
+    copy_task_t tasks[BATCH_SIZE];
+    size_t count;
+    unsigned long long dev;
+    size_t queued;
+} watch_batch_t;
+
+// "root" for the root itself, "root/rel" otherwise.
+static char* join_path(const char* root, const char* rel) {
+    size_t len = strlen(root) + strlen(rel) + 2;
+    char* path = malloc(len);
+    if (!path) return NULL;
+
+    if (*rel) snprintf(path, len, "%s/%s", root, rel);
+    else snprintf(path, len, "%s", root);
+
+    return path;
+}
+
+static int remember_wd(watch_t* watch, int wd, const char* rel) {
+    if (wd >= watch->wd_capacity) {
+        int capacity = MAX(watch->wd_capacity * 2, wd + 1);
+        char** paths = realloc(watch->wd_paths, capacity * sizeof(char*));
+        if (!paths) return ENOMEM;
+
+        memset(paths + watch->wd_capacity, 0, (capacity - watch->wd_capacity) * sizeof(char*));
+        watch->wd_paths = paths;
+        watch->wd_capacity = capacity;
+    }
+
+    char* copy = strdup(rel);
+    if (!copy) return ENOMEM;
+
+    // Re-adding a watch for an inode that moved returns the same wd; the path is simply updated.
+    if (watch->wd_paths[wd]) free(watch->wd_paths[wd]);
+    else ++watch->watched;
+    watch->wd_paths[wd] = copy;
+
+    return 0;
+}
+
+static int add_pending(watch_t* watch, const char* dir_rel, const char* name) {
+    if (watch->pending_count == watch->pending_capacity) {
+        size_t capacity = MAX(watch->pending_capacity * 2, (size_t)WATCH_BATCH_SIZE);
+        char** pending = realloc(watch->pending, capacity * sizeof(char*));
+        if (!pending) return ENOMEM;
+
+        watch->pending = pending;
+        watch->pending_capacity = capacity;
+    }
+
+    char* rel = *dir_rel ? join_path(dir_rel, name) : strdup(name);
+    if (!rel) return ENOMEM;
+
+    watch->pending[watch->pending_count++] = rel;
+    return 0;
+}
+
+static int emit(watch_t* watch, watch_batch_t* batch, const char* rel, const struct stat* st) {
+    copy_task_t task = {0};
+    task.kind = TASK_REFRESH;
+    task.source_path = join_path(watch->src_root, rel);
+    task.dest_path = join_path(watch->dest_root, rel);
+
+    if (!task.source_path || !task.dest_path) {
+        free(task.source_path);
+        free(task.dest_path);
+        return ENOMEM;
+    }
+
+    if (st && S_ISREG(st->st_mode)) task.file_size = (size_t)st->st_size;
+    if (st) task.ino = (unsigned long long)st->st_ino;
+    task.buffer_size = calculate_buffer_size(task.file_size);
+
+    unsigned long long dev = st ? (unsigned long long)st->st_dev : watch->root_dev;
+    if (push_task(batch->pools, batch->tasks, &batch->count, &batch->dev, task, dev) != 0) return ENOMEM;
+
+    ++batch->queued;
+    return 0;
+}
+
+// Watches rel and everything below it; with a batch, every entry is also queued for refresh,
+// which is how directories created or moved into the tree get their existing contents copied.
+static int watch_tree(watch_t* watch, const char* rel, watch_batch_t* batch) {
+    char* path = join_path(watch->src_root, rel);
+    if (!path) return ENOMEM;
+
+    int err_code = 0;
+    DIR* dir = NULL;
+
+    int wd = inotify_add_watch(watch->fd, path, WATCH_MASK);
+    if (wd == -1) {
+        int err = errno;
+        // ENOENT: the directory is already gone again, its delete event is on its way.
+        if (err != ENOENT) fprintf(stderr, RED "watch error: Cannot watch \"%s\", code: %d\n" RESET, path, err);
+        if (err == ENOSPC) err_code = ENOSPC;
+        goto cleanup;
+    }
+    if ((err_code = remember_wd(watch, wd, rel)) != 0) goto cleanup;
+
+    dir = opendir(path);
+    if (!dir) goto cleanup;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        char* child_rel = *rel ? join_path(rel, entry->d_name) : strdup(entry->d_name);
+        char* child_path = child_rel ? join_path(watch->src_root, child_rel) : NULL;
+        if (!child_rel || !child_path) {
+            free(child_rel);
+            free(child_path);
+            err_code = ENOMEM;
+            goto cleanup;
+        }
+
+        struct stat st;
+        if (lstat(child_path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                if (batch) err_code = emit(watch, batch, child_rel, &st);
+                if (err_code == 0) err_code = watch_tree(watch, child_rel, batch);
+            } else if (batch && check_extension(child_path, watch->filter)) {
+                err_code = emit(watch, batch, child_rel, &st);
+            }
+        }
+
+        free(child_rel);
+        free(child_path);
+        if (err_code != 0) goto cleanup;
+    }
+
+cleanup:
+    if (dir) closedir(dir);
+    free(path);
+
+    return err_code;
+}
+
+int watch_init(watch_t* watch, const char* src_root, const char* dest_root, const char* filter, int debounce_ms) {
+    memset(watch, 0, sizeof(*watch));
+    watch->src_root = src_root;
+    watch->dest_root = dest_root;
+    watch->filter = filter;
+    watch->debounce_ms = debounce_ms > 0 ? debounce_ms : DEFAULT_DEBOUNCE_MS;
+
+    struct stat st;
+    if (stat(src_root, &st) == 0) watch->root_dev = (unsigned long long)st.st_dev;
+
+    if (pipe2(stop_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        fprintf(stderr, RED "watch error: Cannot create stop pipe, code: %d\n" RESET, errno);
+        return -1;
+    }
+
+    watch->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (watch->fd == -1) {
+        fprintf(stderr, RED "watch error: inotify_init1 failed, code: %d\n" RESET, errno);
+        watch_destroy(watch);
+        return -1;
+    }
+
+    int err = watch_tree(watch, "", NULL);
+    if (err != 0) {
+        fprintf(
+            stderr, RED "watch error: Cannot watch \"%s\", code: %d%s\n" RESET, src_root, err,
+            err == ENOSPC ? " (raise fs.inotify.max_user_watches)" : ""
+        );
+        watch_destroy(watch);
+        return -1;
+    }
+
+    printf(PRP "Watching %zu directories under \"%s\"\n" RESET, watch->watched, src_root);
+    return 0;
+}
+
+void watch_destroy(watch_t* watch) {
+    if (watch->fd > 0) close(watch->fd);
+    watch->fd = -1;
+
+    for (int i = 0; i < watch->wd_capacity; ++i) free(watch->wd_paths[i]);
+    free(watch->wd_paths);
+    watch->wd_paths = NULL;
+    watch->wd_capacity = 0;
+
+    for (size_t i = 0; i < watch->pending_count; ++i) free(watch->pending[i]);
+    free(watch->pending);
+    watch->pending = NULL;
+    watch->pending_count = watch->pending_capacity = 0;
+
+    for (int i = 0; i < 2; ++i) {
+        if (stop_pipe[i] != -1) close(stop_pipe[i]);
+        stop_pipe[i] = -1;
+    }
+}
+
+void watch_request_stop(void) {
+    if (stop_pipe[1] != -1) {
+        char c = 0;
+        ssize_t res = write(stop_pipe[1], &c, 1);
+        (void)res;
+    }
+}
+
+static void record_event(watch_t* watch, const struct inotify_event* event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // Events were dropped: refreshing the root rewalks and recopies the whole tree.
+        fprintf(stderr, YEL "watch: inotify queue overflowed, rescanning \"%s\"\n" RESET, watch->src_root);
+        add_pending(watch, "", "");
+        return;
+    }
+
+    if (event->wd < 0 || event->wd >= watch->wd_capacity || !watch->wd_paths[event->wd]) return;
+
+    if (event->mask & IN_IGNORED) {
+        free(watch->wd_paths[event->wd]);
+        watch->wd_paths[event->wd] = NULL;
+        --watch->watched;
+        return;
+    }
+
+    if (event->len > 0) add_pending(watch, watch->wd_paths[event->wd], event->name);
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Sorting puts each directory right before its contents, so paths already covered by a
+// directory walk in this flush (and repeated events for one path) are skipped.
+static int flush_pending(watch_t* watch, device_pools_t* pools) {
+    watch_batch_t batch = {0};
+    batch.pools = pools;
+
+    int err_code = 0;
+    const char* walked = NULL;
+
+    qsort(watch->pending, watch->pending_count, sizeof(char*), compare_paths);
+
+    for (size_t i = 0; i < watch->pending_count && err_code == 0; ++i) {
+        const char* rel = watch->pending[i];
+
+        if (i > 0 && strcmp(rel, watch->pending[i - 1]) == 0) continue;
+        if (walked) {
+            size_t len = strlen(walked);
+            if (len == 0 || (strncmp(rel, walked, len) == 0 && rel[len] == '/')) continue;
+            walked = NULL;
+        }
+
+        char* src_path = join_path(watch->src_root, rel);
+        if (!src_path) {
+            err_code = ENOMEM;
+            break;
+        }
+
+        struct stat st;
+        if (lstat(src_path, &st) != 0) {
+            // Gone: the worker removes the destination copy.
+            err_code = emit(watch, &batch, rel, NULL);
+        } else if (S_ISDIR(st.st_mode)) {
+            if (*rel) err_code = emit(watch, &batch, rel, &st);
+            if (err_code == 0) err_code = watch_tree(watch, rel, &batch);
+            walked = rel;
+        } else if (check_extension(src_path, watch->filter)) {
+            err_code = emit(watch, &batch, rel, &st);
+        }
+
+        free(src_path);
+    }
+
+    if (err_code == 0 && flush_batch(pools, batch.dev, batch.tasks, &batch.count) != 0) err_code = ENOMEM;
+    // Replication lag matters more than seek order here: do not leave refreshes in a reorder window.
+    device_pools_flush(pools);
+
+    printf(WEAK "watch: %zu changed paths, %zu refresh tasks queued\n" RESET, watch->pending_count, batch.queued);
+    watch->refreshed += batch.queued;
+
+    for (size_t i = 0; i < watch->pending_count; ++i) free(watch->pending[i]);
+    watch->pending_count = 0;
+
+    return err_code;
+}
+
+int watch_run(watch_t* watch, device_pools_t* pools) {
+    // inotify_event is variable-length; the buffer must be aligned for it.
+    char buffer[64 * KILO_BYTE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+        { .fd = watch->fd, .events = POLLIN },
+        { .fd = stop_pipe[0], .events = POLLIN }
+    };
+
+    double debounce = watch->debounce_ms / 1e3;
+    double first_event = 0;
+    double last_event = 0;
+    int err_code = 0;
+
+    for (;;) {
+        // Idle means an unbounded poll: no timers, no CPU until something changes.
+        int timeout = -1;
+        if (watch->pending_count) {
+            double deadline = MIN(last_event + debounce, first_event + debounce * WATCH_MAX_DELAY_FACTOR);
+            double now = monotonic_seconds();
+            timeout = deadline <= now ? 0 : (int)((deadline - now) * 1e3) + 1;
+        }
+
+        if (poll(fds, 2, timeout) < 0) {
+            if (errno == EINTR) continue;
+            err_code = errno;
+            break;
+        }
+        if (fds[1].revents) break;
+
+        if (fds[0].revents & POLLIN) {
+            ssize_t len;
+            while ((len = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+                for (char* cursor = buffer; cursor < buffer + len; ) {
+                    const struct inotify_event* event = (const struct inotify_event*)cursor;
+                    record_event(watch, event);
+                    cursor += sizeof(struct inotify_event) + event->len;
+                }
+            }
+
+            if (watch->pending_count) {
+                last_event = monotonic_seconds();
+                if (first_event == 0) first_event = last_event;
+            }
+        }
+
+        if (watch->pending_count) {
+            double now = monotonic_seconds();
+            if (now >= last_event + debounce || now >= first_event + debounce * WATCH_MAX_DELAY_FACTOR) {
+                err_code = flush_pending(watch, pools);
+                first_event = last_event = 0;
+                if (err_code != 0) break;
+            }
+        }
+    }
+
+    if (watch->pending_count && err_code == 0) err_code = flush_pending(watch, pools);
+
+    printf(PRP "Watch stopped, %zu refresh tasks queued in total\n" RESET, watch->refreshed);
+    return err_code;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st; (void)flag; (void)ftw;
+    return remove(path) == 0 || errno == ENOENT ? 0 : errno;
+}
+
+static int remove_tree(const char* path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return errno == ENOENT ? 0 : errno;
+
+    if (S_ISDIR(st.st_mode)) return nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS) == 0 ? 0 : errno;
+    return unlink(path) == 0 || errno == ENOENT ? 0 : errno;
+}
+
+static char* temp_path(const char* dest, int unique) {
+    const char* slash = strrchr(dest, '/');
+    size_t dir_len = slash ? (size_t)(slash - dest) + 1 : 0;
+    size_t len = strlen(dest) + 32;
+
+    char* path = malloc(len);
+    if (path) snprintf(path, len, "%.*s.%s.copyer-%d", (int)dir_len, dest, dest + dir_len, unique);
+
+    return path;
+}
+
+// Refresh tasks bypass the worker's directory cache: a directory removed by one worker may still be
+// cached as an open fd by another, so the parents are resolved (and created if needed) by path.
+int refresh_entry(const char* src, char* const* dests, int dest_count, int* errors, worker_stats_t* thread_stat, size_t buff_size, int unique) {
+    struct stat st;
+    int res = 0;
+
+    if (lstat(src, &st) != 0) {
+        int err = errno;
+        for (int k = 0; k < dest_count; ++k) errors[k] = err == ENOENT ? remove_tree(dests[k]) : err;
+        goto done;
+    }
+
+    for (int k = 0; k < dest_count; ++k) errors[k] = make_parents(dests[k]);
+
+    if (S_ISDIR(st.st_mode)) {
+        for (int k = 0; k < dest_count; ++k) {
+            if (errors[k] != 0) continue;
+
+            struct stat dest_st;
+            if (lstat(dests[k], &dest_st) == 0 && !S_ISDIR(dest_st.st_mode)) errors[k] = remove_tree(dests[k]);
+            if (errors[k] == 0) errors[k] = make_directory(dests[k], NULL);
+        }
+        goto done;
+    }
+
+    if (S_ISLNK(st.st_mode)) {
+        for (int k = 0; k < dest_count; ++k) {
+            if (errors[k] == 0) errors[k] = remove_tree(dests[k]);
+            if (errors[k] == 0) errors[k] = copy_symlink(src, dests[k], thread_stat, NULL);
+        }
+        goto done;
+    }
+
+    char* temps[MAX_DESTINATIONS] = {0};
+    int copy_errors[MAX_DESTINATIONS] = {0};
+    for (int k = 0; k < dest_count; ++k) {
+        temps[k] = temp_path(dests[k], unique);
+        if (!temps[k]) {
+            for (int j = 0; j < k; ++j) free(temps[j]);
+            for (int j = 0; j < dest_count; ++j) errors[j] = ENOMEM;
+            goto done;
+        }
+        // Leftover from an interrupted run.
+        unlink(temps[k]);
+    }
+
+    copy_file_multi(src, (const char* const*)temps, dest_count, copy_errors, thread_stat, buff_size, NULL);
+
+    for (int k = 0; k < dest_count; ++k) {
+        if (errors[k] == 0) errors[k] = copy_errors[k];
+        if (errors[k] == 0) {
+            struct stat dest_st;
+            if (lstat(dests[k], &dest_st) == 0 && S_ISDIR(dest_st.st_mode)) errors[k] = remove_tree(dests[k]);
+            if (errors[k] == 0 && rename(temps[k], dests[k]) != 0) errors[k] = errno;
+        }
+        if (errors[k] != 0) unlink(temps[k]);
+        free(temps[k]);
+    }
+
+done:
+    for (int k = 0; k < dest_count && res == 0; ++k) res = errors[k];
+    return res;
+}
+
+#endif
\ No newline at end of file
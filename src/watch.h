@@ -0,0 +1,55 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "core.h"
+
+#define DEFAULT_DEBOUNCE_MS 100
+#define WATCH_MAX_DELAY_FACTOR 10
+#define WATCH_BATCH_SIZE 256
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Continuous replication after the initial copy. Watches are added before the initial scan so
+// nothing changed while it runs is lost; events are then coalesced per path for debounce_ms of
+// quiet (at most WATCH_MAX_DELAY_FACTOR times that during a steady stream) and the affected
+// paths are handed to the worker pools as TASK_REFRESH tasks.
+typedef struct watch_t {
+    const char* src_root;
+    const char* dest_root;
+    const char* filter;
+    int debounce_ms;
+
+    int fd;
+    unsigned long long root_dev;
+    char** wd_paths;
+    int wd_capacity;
+    size_t watched;
+
+    char** pending;
+    size_t pending_count;
+    size_t pending_capacity;
+
+    size_t refreshed;
+} watch_t;
+
+int watch_init(watch_t* watch, const char* src_root, const char* dest_root, const char* filter, int debounce_ms);
+void watch_destroy(watch_t* watch);
+
+// Runs until watch_request_stop(); flushes whatever is still pending before returning.
+int watch_run(watch_t* watch, device_pools_t* pools);
+
+// Async-signal-safe, meant for SIGINT/SIGTERM handlers.
+void watch_request_stop(void);
+
+// Worker side of TASK_REFRESH: brings every destination in line with the current state of src,
+// whatever that is now (file, symlink, directory or gone). Files are copied to a temporary name
+// and renamed over the old copy, so readers of the destination never see a partial file.
+int refresh_entry(const char* src, char* const* dests, int dest_count, int* errors, worker_stats_t* thread_stat, size_t buff_size, int unique);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file